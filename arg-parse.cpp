@@ -1,12 +1,74 @@
 #include "arg-parse.hpp"
+#include "synthetic_camera.hpp"
+#include "hs_kernels.hpp"
 #include "version.h"
+#include <ctype.h>
+#include <errno.h>
 #include <string.h>
+#include <sstream>
 
 using namespace std;
 
+// Parse comma separated list of smoothing factors of moving averages
+static bool parse_alphas(const char *arg, vector<double> &alphas)
+{
+    stringstream ss(arg);
+    string item;
+    alphas.clear();
+    while (getline(ss, item, ',')) {
+        char *end;
+        double a = strtod(item.c_str(), &end);
+        if (item.empty() || *end || !(a >= 0 && a < 1))
+            return false;
+        alphas.push_back(a);
+    }
+    return !alphas.empty() && alphas.size() <= hs_kernels::ema_bank<float>::max_size;
+}
+
+// Parse --hs-windows option (comma separated list of key=value pairs)
+static void parse_windows(const string &spec, rolling_window &mean, rolling_window &stddev)
+{
+    stringstream ss(spec);
+    string item;
+
+    while (getline(ss, item, ',')) {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        string key = item.substr(0, eq);
+        string val = eq == string::npos ? "" : item.substr(eq + 1);
+        try {
+            if (key == "mean") {
+                mean.size = stoul(val);
+            } else if (key == "stddev") {
+                stddev.size = stoul(val);
+            } else if (key == "method") {
+                if (val == "exact")
+                    mean.m = rolling_window::method::exact;
+                else if (val == "blocks")
+                    mean.m = rolling_window::method::blocks;
+                else if (val == "exp")
+                    mean.m = rolling_window::method::exponential;
+                else
+                    throw invalid_argument(val);
+                stddev.m = mean.m;
+            } else if (key == "block") {
+                mean.block = stddev.block = stoul(val);
+            } else {
+                throw runtime_error("Unknown --hs-windows option: " + key);
+            }
+        } catch (const logic_error &) { // invalid_argument, out_of_range
+            throw runtime_error("Invalid value of --hs-windows option " + key + ": " + val);
+        }
+    }
+    if (mean.size == 0 || stddev.size == 0)
+        throw runtime_error("Rolling window size must be positive");
+}
+
 static error_t parse_opt(int key, char *arg, struct argp_state *argp_state)
 {
     cmd_arguments &args = *reinterpret_cast<cmd_arguments*>(argp_state->input);
+    cmd_arguments::camera &cam = args.cameras.back();
 
     switch (key) {
     case 'e':
@@ -15,16 +77,44 @@ static error_t parse_opt(int key, char *arg, struct argp_state *argp_state)
             args.poi_export_path = arg;
         break;
     case 'p':
-        args.poi_import_path = arg;
+        cam.poi_import_path = arg;
         break;
     case 's':
         args.show_poi_path = arg;
         break;
     case 'l':
-        args.license_file = arg;
+        cam.license_file = arg;
         break;
     case 'r':
-        args.vid_out_path = arg;
+        cam.vid_out_path = arg;
+        break;
+    case OPT_RECORD_RAW:
+        cam.raw_out_path = arg;
+        break;
+    case OPT_RECORD_APPEND:
+        args.raw_out_append = true;
+        break;
+    case OPT_SEEK: {
+        char *end;
+        errno = 0;
+        cam.seek = strtoul(arg, &end, 10);
+        if (!isdigit((unsigned char)arg[0]) || *end || errno == ERANGE) { // No sign or spaces
+            argp_error(argp_state, "Invalid frame number: %s", arg);
+            return EINVAL;
+        }
+        break;
+    }
+    case OPT_BATCH:
+        args.batch = true;
+        break;
+    case OPT_SYNTHETIC:
+        cam.synthetic = true;
+        cam.synthetic_opts = arg ? arg : "";
+        try {
+            synthetic_camera::params::parse(cam.synthetic_opts);
+        } catch (const runtime_error &e) {
+            argp_error(argp_state, "%s", e.what());
+        }
         break;
     case OPT_FOURCC:
         if (strlen(arg) != 4) {
@@ -34,10 +124,10 @@ static error_t parse_opt(int key, char *arg, struct argp_state *argp_state)
         args.fourcc = arg;
         break;
     case 'v':
-        args.vid_in_path = arg;
+        cam.vid_in_path = arg;
         break;
     case 'c':
-        args.poi_csv_file = arg;
+        cam.poi_csv_file = arg;
         break;
     case 'd':
         args.display_delay_us = atof(arg) * 1000000;
@@ -55,7 +145,7 @@ static error_t parse_opt(int key, char *arg, struct argp_state *argp_state)
         }
         break;
     case 'h':
-        args.heat_sources_border_points = arg;
+        cam.heat_sources_border_points = arg;
         break;
     case OPT_SAVE_IMG_DIR:
         args.save_img_dir = arg;
@@ -69,13 +159,102 @@ static error_t parse_opt(int key, char *arg, struct argp_state *argp_state)
         args.webserver_active = true;
         break;
     case OPT_COMPENZATION_IMG:
-        args.compenzation_img = arg;
+        cam.compenzation_img = arg;
+        break;
+    case OPT_CAMERA:
+        args.cameras.emplace_back();
+        break;
+    case OPT_FRAME_MODE:
+        if (string(arg) == "latest") {
+            args.frame_mode = cmd_arguments::frame_mode::latest;
+        } else if (string(arg) == "every") {
+            args.frame_mode = cmd_arguments::frame_mode::every;
+        } else {
+            argp_error(argp_state, "Unknown frame mode: %s", arg);
+            return EINVAL;
+        }
+        break;
+    case OPT_MATCHER:
+        if (string(arg) == "flann") {
+            args.matcher = cmd_arguments::matcher::flann;
+        } else if (string(arg) == "hamming") {
+            args.matcher = cmd_arguments::matcher::hamming;
+        } else if (string(arg) == "lsh") {
+            args.matcher = cmd_arguments::matcher::lsh;
+        } else {
+            argp_error(argp_state, "Unknown matcher: %s", arg);
+            return EINVAL;
+        }
+        break;
+    case OPT_TRACK_BUDGET: {
+        char *end;
+        args.track_budget_ms = strtod(arg, &end);
+        if (!*arg || *end || !(args.track_budget_ms >= 0)) {
+            argp_error(argp_state, "Invalid tracking time budget: %s", arg);
+            return EINVAL;
+        }
+        break;
+    }
+    case OPT_MJPEG_PORT: {
+        char *end;
+        long port = strtol(arg, &end, 10);
+        if (!*arg || *end || port < 0 || port > 65535 || port == 8080) { // Webserver::web_port
+            argp_error(argp_state, "Invalid MJPEG port: %s", arg);
+            return EINVAL;
+        }
+        args.mjpeg_port = port;
+        break;
+    }
+    case OPT_KLT:
+        if (atol(arg) < 0) {
+            argp_error(argp_state, "Invalid KLT interval: %s", arg);
+            return EINVAL;
+        }
+        args.klt_interval = atol(arg);
+        break;
+    case OPT_HS_PRECISION:
+        if (string(arg) == "double") {
+            args.hs_precision = cmd_arguments::hs_precision::float64;
+        } else if (string(arg) == "float") {
+            args.hs_precision = cmd_arguments::hs_precision::float32;
+        } else if (string(arg) == "check") {
+            args.hs_precision = cmd_arguments::hs_precision::check;
+        } else {
+            argp_error(argp_state, "Unknown heat sources precision: %s", arg);
+            return EINVAL;
+        }
+        break;
+    case OPT_HS_ALPHAS:
+    case OPT_HS_IMG_ALPHAS:
+        if (!parse_alphas(arg, key == OPT_HS_ALPHAS ? args.hs_alphas : args.hs_img_alphas)) {
+            argp_error(argp_state, "Invalid list of smoothing factors: %s (expected 1-%zu numbers between 0 and 1)",
+                       arg, hs_kernels::ema_bank<float>::max_size);
+            return EINVAL;
+        }
+        break;
+    case OPT_HS_WINDOWS:
+        try {
+            parse_windows(arg, args.hs_mean_window, args.hs_stddev_window);
+        } catch (const runtime_error &e) {
+            argp_error(argp_state, "%s", e.what());
+        }
         break;
     case ARGP_KEY_END:
         if (args.save_img && args.save_img_dir.empty())
             args.save_img_dir = ".";
         if (args.save_img &&args.save_img_period == 0)
             args.save_img_period = 1;
+        for (const cmd_arguments::camera &c : args.cameras) {
+            if (c.synthetic && !c.vid_in_path.empty())
+                argp_error(argp_state, "--synthetic and -v cannot be used together");
+            if (args.batch && c.vid_in_path.empty() && !c.synthetic)
+                argp_error(argp_state, "--batch requires an input file (-v) or --synthetic");
+            if (args.batch && c.synthetic &&
+                synthetic_camera::params::parse(c.synthetic_opts).frames == 0)
+                argp_error(argp_state, "--batch requires a limited number of synthetic frames (frames=N)");
+        }
+        if (args.cameras.size() > 1 && args.enter_poi)
+            argp_error(argp_state, "--enter-poi cannot be used with multiple cameras");
         break;
     default:
         return ARGP_ERR_UNKNOWN;
@@ -91,16 +270,44 @@ static struct argp_option options[] = {
     { "license-file",    'l', "FILE",        0, "Path of WIC license file." },
     { "record-video",    'r', "FILE",        0, "Record video and store it with entered filename"},
     { "fourcc",          OPT_FOURCC, "CODE", 0, "4-letter code for video codec used by -r (e.g. MJPG, h264), default: HFYU"},
-    { "load-video",      'v', "FILE",        0, "Load and process video instead of camera feed"},
+    { "record-raw",      OPT_RECORD_RAW, "FILE", 0, "Record lossless raw camera data (16 bit pixels, timestamps, camera temperatures) to FILE. The recording can be replayed with -v."},
+    { "record-append",   OPT_RECORD_APPEND, 0, 0, "Append frames to an existing --record-raw file instead of overwriting it."},
+    { "load-video",      'v', "FILE",        0, "Load and process video or raw recording (see --record-raw) instead of camera feed"},
+    { "synthetic",       OPT_SYNTHETIC, "OPTS", OPTION_ARG_OPTIONAL, "Process generated images of a PCB with moving and switching hot spots instead of camera feed. "
+                                                    "OPTS is a comma separated list of: size=WxH (640x512), fps=N (9), frames=N (unlimited), "
+                                                    "hotspots=N (4), switch=SECS (1), drift=PX (10), seed=N (1), truth=FILE (CSV of ground truth homographies)."},
+    { "seek",            OPT_SEEK, "FRAME", 0, "Start processing of the video or raw recording at the given frame number."},
+    { "batch",           OPT_BATCH, 0,       0, "Process the -v or --synthetic input only once, as fast as possible, and exit. Frame rate and time spent in individual processing stages are reported at the end."},
     { "csv-log",         'c', "FILE",        0, "Log temperature of POIs to a csv file instead of printing them to stdout."},
     { "save-img-dir",    OPT_SAVE_IMG_DIR, "DIR",  0, "Target directory for saving an image with POIs every \"save-img-period\" seconds.\n\".\" by default."},
     { "save-img-period", OPT_SAVE_IMG_PER, "SECS", 0, "Period for saving an image with POIs to \"save-img-dir\".\n1s by default."},
     { "track-points",    't', "once",        OPTION_ARG_OPTIONAL, "Turn on tracking of points. If \"once\" is specified, tacking happens only for the first image. "
                                                                   "This allows faster processing if the board doesn't move. If \"bg\" is specified, calculations run in a background thread."},
+    { "matcher",         OPT_MATCHER, "METHOD", 0, "Descriptor matching method of point tracking: \"flann\" (default, KD-tree on descriptors converted to float), "
+                                                    "\"hamming\" (brute force Hamming distance) or \"lsh\" (locality sensitive hashing of binary descriptors)."},
+    { "track-budget",    OPT_TRACK_BUDGET, "MS", 0, "Time budget for finding the homography of tracked points in each frame. "
+                                                    "RANSAC then stops early when most matches are inliers and starts from the previous homography. "
+                                                    "Default (0) is a fixed, large number of iterations."},
+    { "klt",             OPT_KLT, "N",       0, "Run full keypoint matching of tracked points only every N-th frame and propagate the homography "
+                                                    "by optical flow (KLT) in between. Full matching also runs when optical flow loses too many points. "
+                                                    "Default (0) matches every frame."},
     { "heat-sources",    'h', "PT_LIST",     0, "Enables heat sources detection. PT_LIST is a comma separated list of names of 4 points (specified with -p) that define detection area. In most cases, you'll want to enable -t too."},
     { "delay",           'd', "NUM",         0, "Set delay between each measurement/display in seconds."},
     { "webserver",       'w', 0,             0, "Start webserver to display image and temperatures."},
+    { "mjpeg-port",      OPT_MJPEG_PORT, "PORT", 0, "Port of the MJPEG streams of all cameras (default 8081, 0 disables them). "
+                                                    "It must differ from the web server port (8080)."},
     { "compenzation-img", OPT_COMPENZATION_IMG, "FILE", 0, "Compenzation image (to subtract from grabbed image)"},
+    { "camera",          OPT_CAMERA, 0,      0, "Add another camera. The options -c, -h, -l, -p, -r, -v, --compenzation-img, --record-raw, --seek and --synthetic "
+                                                    "given after this option apply to the new camera; those given before the first --camera apply to the first one."},
+    { "frame-mode",      OPT_FRAME_MODE, "MODE", 0, "Which grabbed frames to process: \"latest\" skips frames when processing is slower than the camera, \"every\" processes all of them. "
+                                                    "Default is \"latest\" for camera and \"every\" for video input."},
+    { "hs-precision",    OPT_HS_PRECISION, "PREC", 0, "Floating point precision of heat sources detection: \"double\" (default), \"float\" (faster) "
+                                                    "or \"check\" (calculate both and warn when the float results deviate)."},
+    { "hs-alphas",       OPT_HS_ALPHAS, "LIST", 0, "Comma separated smoothing factors of averaged detail, Laplacian and L+ images shown by the webserver, default: 0.9,0.99,0.997"},
+    { "hs-img-alphas",   OPT_HS_IMG_ALPHAS, "LIST", 0, "Comma separated smoothing factors of averaged heat source images, default: 0.9,0.99,0.999"},
+    { "hs-windows",      OPT_HS_WINDOWS, "OPTS", 0, "Rolling windows of the L+ mean and of the detail and Laplacian standard deviations shown by the webserver. "
+                                                    "OPTS is a comma separated list of: mean=N (1000), stddev=N (100), "
+                                                    "method=exact|blocks|exp (exact), block=N (window/64, for method=blocks)."},
     { 0 }
 };
 
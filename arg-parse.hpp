@@ -1,8 +1,10 @@
 #ifndef ARG_PARSE_HPP
 #define ARG_PARSE_HPP
 
+#include "rolling_stats.hpp"
 #include <argp.h>
 #include <string>
+#include <vector>
 
 
 enum opt {
@@ -10,28 +12,67 @@ enum opt {
     OPT_SAVE_IMG_DIR,
     OPT_SAVE_IMG_PER,
     OPT_COMPENZATION_IMG,
+    OPT_FRAME_MODE,
+    OPT_RECORD_RAW,
+    OPT_RECORD_APPEND,
+    OPT_SEEK,
+    OPT_BATCH,
+    OPT_SYNTHETIC,
+    OPT_CAMERA,
+    OPT_HS_PRECISION,
+    OPT_HS_ALPHAS,
+    OPT_HS_IMG_ALPHAS,
+    OPT_HS_WINDOWS,
+    OPT_MATCHER,
+    OPT_TRACK_BUDGET,
+    OPT_KLT,
+    OPT_MJPEG_PORT,
 };
 
 /* Command line options */
 struct cmd_arguments{
+    /* Options specific to one camera (see --camera) */
+    struct camera {
+        std::string license_file;
+        std::string vid_in_path;
+        bool synthetic = false;
+        std::string synthetic_opts;
+        size_t seek = 0;
+        std::string poi_import_path;
+        std::string heat_sources_border_points;
+        std::string compenzation_img;
+        std::string poi_csv_file;
+        std::string vid_out_path;
+        std::string raw_out_path;
+    };
+    std::vector<camera> cameras = std::vector<camera>(1);
+
     bool enter_poi = false;
     std::string poi_export_path;
-    std::string poi_import_path;
     std::string show_poi_path;
-    std::string license_file;
-    std::string vid_in_path;
-    std::string vid_out_path;
+    bool raw_out_append = false;
+    bool batch = false;
     std::string fourcc = "HFYU";
     int display_delay_us = 0;
-    std::string poi_csv_file;
     bool save_img = false;
     std::string save_img_dir;
     double save_img_period = 0;
     bool webserver_active = false;
+    unsigned short mjpeg_port = 8081; // 0 = no MJPEG streams
     enum class tracking {on, off, once, background};
     tracking tracking = tracking::off;
-    std::string heat_sources_border_points;
-    std::string compenzation_img;
+    enum class matcher {flann, hamming, lsh};
+    matcher matcher = matcher::flann;
+    double track_budget_ms = 0; // 0 = fixed number of RANSAC iterations
+    unsigned klt_interval = 0;  // 0 = full matching of every frame
+    enum class frame_mode {automatic, latest, every};
+    frame_mode frame_mode = frame_mode::automatic;
+    enum class hs_precision {float64, float32, check};
+    hs_precision hs_precision = hs_precision::float64;
+    std::vector<double> hs_alphas;     // Empty means default
+    std::vector<double> hs_img_alphas;
+    rolling_window hs_mean_window { 1000 };
+    rolling_window hs_stddev_window { 100 };
 };
 
 extern struct argp argp;
@@ -0,0 +1,140 @@
+#ifndef CAMERA_SOURCE_HPP
+#define CAMERA_SOURCE_HPP
+
+#include "temp_lut.hpp"
+#include <opencv2/core/mat.hpp>
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The colors 0-255 in recordings correspond to temperatures 15-120C
+#define RECORD_MIN_C 15
+#define RECORD_MAX_C 120
+
+// Camera component temperatures [°C] read at the given time
+struct camera_temps {
+    std::vector<std::pair<std::string, double>> values; // shutter, sensor, housing
+    std::chrono::system_clock::time_point time;
+
+    // Value of the given component (NaN if not available)
+    double get(const std::string &name) const
+    {
+        for (const auto &v : values)
+            if (v.first == name)
+                return v.second;
+        return NAN;
+    }
+};
+
+// Source of raw thermal images (camera, recording, generator).
+//
+// Implementations deliver 16-bit raw pixels in their fastest way and
+// provide the table for converting them to °C. get_image() is called
+// only from one thread (the capture thread); get_lut() and
+// get_component_temps() may be called from any thread.
+class camera_source {
+public:
+    enum class pixel_format {
+        raw16,                  // Calibrated 16-bit radiometric values
+        gray8,                  // 8-bit grayscale (fixed temperature range)
+        bgr8,                   // 8-bit color (fixed temperature range)
+    };
+
+    struct capabilities {
+        std::string backend;    // Short name for logs and metrics
+        int width = 0, height = 0;
+        double fps = 0;         // Native frame rate (0 if unknown)
+        std::vector<pixel_format> formats; // Formats provided by the device or file; the first one is used
+        bool zero_copy = false; // Images reference memory of the source (no copy per frame)
+        bool live = false;      // Images come in real time
+        bool seekable = false;
+    };
+
+    virtual ~camera_source() = default;
+
+    virtual capabilities get_capabilities() const = 0;
+
+    // Grab the next image and the time when it was taken. Returns
+    // false at the end of a finite input (see set_loop()).
+    virtual bool get_image(cv::Mat_<uint16_t> &result, std::chrono::system_clock::time_point &time) = 0;
+
+    // Raw value corresponding to the given temperature
+    virtual uint16_t celsius_to_raw(double celsius) const = 0;
+
+    // Read camera component temperatures (shutter, sensor, housing)
+    // from the device. This may take long, so it is called only by
+    // poll_component_temps().
+    virtual std::vector<std::pair<std::string, double>> read_component_temps()
+    {
+        return { { "camera_shutter", 0 }, { "camera_sensor", 0 }, { "camera_housing", 0 } };
+    }
+
+    // Read the temperatures and publish them for get_component_temps()
+    void poll_component_temps()
+    {
+        auto t = std::make_shared<camera_temps>();
+        t->values = read_component_temps();
+        t->time = std::chrono::system_clock::now();
+        std::atomic_store(&temps, std::shared_ptr<const camera_temps>(t));
+    }
+
+    // Read only the sensor temperature, which the calibration of
+    // every frame depends on (NaN if the source does not have it)
+    virtual double read_sensor_temp() { return NAN; }
+
+    // Update the sensor temperature in the published values and
+    // keep the others from the last poll_component_temps()
+    void poll_sensor_temp()
+    {
+        double sensor = read_sensor_temp();
+        auto old = get_component_temps();
+        if (std::isnan(sensor) || !old)
+            return;
+        auto t = std::make_shared<camera_temps>(*old);
+        for (auto &v : t->values)
+            if (v.first == "camera_sensor")
+                v.second = sensor;
+        t->time = std::chrono::system_clock::now();
+        std::atomic_store(&temps, std::shared_ptr<const camera_temps>(t));
+    }
+
+    // The last polled temperatures (nullptr before the first poll).
+    // Does not block.
+    std::shared_ptr<const camera_temps> get_component_temps() const { return std::atomic_load(&temps); }
+
+    // Continue at the given frame (only if seekable)
+    virtual void seek(size_t frame) {}
+
+    // Current raw → °C conversion table. It is replaced (not
+    // modified) when the camera changes the temperature resolution,
+    // so frames can keep the table valid at the time of grabbing.
+    std::shared_ptr<const temp_lut> get_lut() const { return std::atomic_load(&lut); }
+
+    // Whether to restart finite inputs after reaching their end
+    void set_loop(bool loop) { this->loop = loop; }
+
+    // Whether non-live sources with a frame rate deliver images at
+    // that rate or as fast as possible
+    void set_realtime(bool realtime) { this->realtime = realtime; }
+
+protected:
+    bool loop = true;
+    bool realtime = true;
+
+    template <typename F>
+    void set_lut(F raw_to_celsius)
+    {
+        std::atomic_store(&lut, std::shared_ptr<const temp_lut>(
+                              std::make_shared<const temp_lut>(raw_to_celsius)));
+    }
+
+private:
+    std::shared_ptr<const temp_lut> lut;
+    std::shared_ptr<const camera_temps> temps;
+};
+
+#endif // CAMERA_SOURCE_HPP
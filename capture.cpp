@@ -0,0 +1,123 @@
+#include "capture.hpp"
+#include <cmath>
+#include <err.h>
+#include <stdexcept>
+
+using namespace std;
+
+capture::capture(img_stream &is, mode m, raw_writer *rec, size_t ring_size)
+    : is(is)
+    , m(m)
+    , lossy(is.is_live())
+    , ring(ring_size)
+    , rec(rec)
+    , thread(&capture::run, this)
+{}
+
+capture::~capture()
+{
+    stop();
+}
+
+void capture::stop()
+{
+    stop_requested = true;
+    ring.close();
+    newest.close();
+    if (thread.joinable())
+        thread.join();
+}
+
+void capture::run()
+{
+    uint64_t seq = 0;
+
+    while (!stop_requested) {
+        frame f;
+        if (!is.get_image(f.rawtemp)) { // End of input
+            ring.close();
+            newest.close();
+            break;
+        }
+        f.lut = is.get_lut();
+        f.timestamp = chrono::steady_clock::now();
+        f.time = is.get_image_time();
+        f.seq = ++seq;
+        captured++;
+
+        if (rec) {
+            try {
+                record(f);
+            } catch (const exception &e) {
+                warnx("Raw recording stopped: %s", e.what());
+                rec = nullptr;
+            }
+        }
+
+        if (lossy && m == mode::latest) {
+            if (newest.put(std::move(f)))
+                overruns++;
+        } else if (lossy) {
+            if (!ring.try_push(std::move(f)))
+                overruns++;
+        } else {
+            while (!stop_requested && !ring.push(std::move(f), chrono::milliseconds(100)))
+                ;
+        }
+    }
+}
+
+void capture::record(const frame &f)
+{
+    raw_frame_header info = {};
+    info.seq = f.seq;
+    info.time_ns = chrono::duration_cast<chrono::nanoseconds>(f.time.time_since_epoch()).count();
+
+    // Component temperatures are not read here, because it takes too
+    // long. We use the last values read in background.
+    auto cct = is.getCameraComponentTemps();
+    info.shutter_temp = cct ? cct->get("camera_shutter") : NAN;
+    info.sensor_temp  = cct ? cct->get("camera_sensor") : NAN;
+    info.housing_temp = cct ? cct->get("camera_housing") : NAN;
+
+    // The conversion to °C is stored in every frame as a linear
+    // function, so it follows changes of the temperature resolution.
+    // Check the linearity whenever the table changes.
+    const temp_lut &lut = *f.lut;
+    info.temp_resolution = (lut[UINT16_MAX] - lut[0]) / UINT16_MAX;
+    info.temp_offset = lut[0];
+    if (f.lut != rec_lut) {
+        const uint16_t mid = 1 << 15;
+        if (!(fabs(lut[mid] - (info.temp_offset + mid * info.temp_resolution)) <= 0.01))
+            throw runtime_error("Conversion to °C is not linear");
+        if (rec_lut)
+            warnx("Temperature resolution changed at frame %llu", (unsigned long long)f.seq);
+        rec_lut = f.lut;
+    }
+
+    rec->write(f.rawtemp, info);
+}
+
+bool capture::next(frame &f, chrono::milliseconds timeout)
+{
+    if (m == mode::every)
+        return ring.pop(f, timeout);
+
+    if (lossy)
+        return newest.take(f, timeout);
+
+    uint64_t s = 0;
+    bool ret = ring.pop_latest(f, timeout, s);
+    skipped += s;
+    return ret;
+}
+
+capture::stats capture::get_stats() const
+{
+    stats s;
+    s.captured = captured;
+    s.overruns = overruns;
+    s.skipped = skipped;
+    s.pool = frame_pool::instance().get_stats();
+    return s;
+}
@@ -0,0 +1,83 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include "img_stream.hpp"
+#include "frame_ring.hpp"
+#include "frame_pool.hpp"
+#include "raw_recording.hpp"
+#include <opencv2/core/mat.hpp>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+struct frame {
+    cv::Mat_<uint16_t> rawtemp;
+    uint64_t seq = 0; // Sequence number assigned by the capture thread (starts at 1)
+    std::chrono::steady_clock::time_point timestamp; // Acquisition time
+    std::chrono::system_clock::time_point time; // Wall-clock acquisition time (recorded one for replays)
+    std::shared_ptr<const temp_lut> lut; // Raw → °C conversion valid for this frame
+};
+
+// Acquisition thread, which grabs images from img_stream and passes
+// them to the processing thread via a bounded ring buffer. This way,
+// slow processing does not delay grabbing of the next camera frame.
+class capture {
+public:
+    enum class mode {
+        latest, // Process only the newest frame, skip the older ones
+        every,  // Process every frame in order
+    };
+
+    struct stats {
+        uint64_t captured = 0; // Frames grabbed from img_stream
+        uint64_t overruns = 0; // Frames lost before processing (live cameras)
+        uint64_t skipped = 0;  // Frames discarded in latest mode
+        frame_pool::stats pool;
+    };
+
+    // If rec is not null, all grabbed frames are recorded there.
+    capture(img_stream &is, mode m, raw_writer *rec = nullptr, size_t ring_size = 4);
+    ~capture();
+
+    // Returns the next frame to process according to the mode. Returns
+    // false if no frame arrived within the timeout.
+    bool next(frame &f, std::chrono::milliseconds timeout);
+
+    void stop();
+
+    // All frames of a finite input (see img_stream::set_loop()) were
+    // grabbed and taken by next().
+    bool finished() const
+    {
+        return ring.is_closed() && ring.size() == 0 && newest.size() == 0;
+    }
+
+    stats get_stats() const;
+
+private:
+    img_stream &is;
+    const mode m;
+    // Live cameras cannot wait for the processing. In mode::latest,
+    // they pass frames through the newest slot; a frame replaced
+    // there before being processed is counted as an overrun. In
+    // mode::every, the order is kept and frames that do not fit into
+    // the full ring are overruns. Other sources are paced by the
+    // processing thread.
+    const bool lossy;
+    spsc_ring<frame> ring;
+    latest_slot<frame> newest;
+    raw_writer *rec;
+    std::shared_ptr<const temp_lut> rec_lut; // Table of the last recorded frame
+
+    std::atomic<bool> stop_requested{ false };
+    std::atomic<uint64_t> captured{ 0 };
+    std::atomic<uint64_t> overruns{ 0 };
+    std::atomic<uint64_t> skipped{ 0 };
+
+    std::thread thread;
+
+    void run();
+    void record(const frame &f);
+};
+
+#endif // CAPTURE_HPP
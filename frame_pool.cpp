@@ -0,0 +1,98 @@
+#include "frame_pool.hpp"
+#include <algorithm>
+
+using namespace cv;
+using namespace std;
+
+frame_pool &frame_pool::instance()
+{
+    static frame_pool *pool = new frame_pool(); // never destroyed
+    return *pool;
+}
+
+frame_pool::frame_pool(size_t max_free)
+    : max_free(max_free)
+{
+    free_list.reserve(max_free);
+}
+
+void frame_pool::create(Mat_<uint16_t> &m, int rows, int cols)
+{
+    m.release();
+    m.allocator = this;
+    m.create(rows, cols);
+}
+
+void frame_pool::create(Mat &m, int rows, int cols, int type)
+{
+    m.release();
+    m.allocator = this;
+    m.create(rows, cols, type);
+}
+
+frame_pool::stats frame_pool::get_stats() const
+{
+    lock_guard<mutex> lk(mtx);
+    stats s = st;
+    s.free = free_list.size();
+    return s;
+}
+
+UMatData *frame_pool::allocate(int dims, const int *sizes, int type, void *data0, size_t *step,
+                               AccessFlag flags, UMatUsageFlags usageFlags) const
+{
+    if (data0) // User supplied buffer - nothing to recycle
+        return Mat::getDefaultAllocator()->allocate(dims, sizes, type, data0, step, flags, usageFlags);
+
+    // Continuous buffer layout, the same as in cv::StdMatAllocator
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step)
+            step[i] = total;
+        total *= sizes[i];
+    }
+
+    {
+        lock_guard<mutex> lk(mtx);
+        auto it = find_if(free_list.begin(), free_list.end(),
+                          [total](UMatData *u) { return u->size == total; });
+        if (it != free_list.end()) {
+            UMatData *u = *it;
+            free_list.erase(it);
+            st.reuses++;
+            return u;
+        }
+        st.allocations++;
+    }
+
+    UMatData *u = new UMatData(this);
+    u->data = u->origdata = static_cast<uchar*>(fastMalloc(total));
+    u->size = total;
+    return u;
+}
+
+bool frame_pool::allocate(UMatData *u, AccessFlag, UMatUsageFlags) const
+{
+    return u != nullptr;
+}
+
+void frame_pool::deallocate(UMatData *u) const
+{
+    if (!u)
+        return;
+
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+
+    {
+        lock_guard<mutex> lk(mtx);
+        if (free_list.size() < max_free) {
+            free_list.push_back(u);
+            return;
+        }
+    }
+
+    fastFree(u->origdata);
+    u->origdata = nullptr;
+    delete u;
+}
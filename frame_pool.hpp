@@ -0,0 +1,47 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <opencv2/core/mat.hpp>
+#include <mutex>
+#include <vector>
+
+// OpenCV allocator that recycles frame buffers. Matrices created with
+// this allocator share reference counted buffers as usual, but when
+// the last reference is dropped (in whichever thread), the buffer is
+// returned to the pool instead of being freed. In steady state, no
+// heap allocations are needed for new frames.
+class frame_pool : public cv::MatAllocator {
+public:
+    struct stats {
+        uint64_t allocations = 0; // Buffers allocated from the heap
+        uint64_t reuses = 0;      // Buffers taken from the pool
+        size_t free = 0;          // Buffers currently in the pool
+    };
+
+    // The pool lives for the whole program lifetime, because matrices
+    // using it may be destroyed at any time, even during exit.
+    static frame_pool &instance();
+
+    // (Re)create m with a buffer from the pool. Unlike
+    // cv::Mat::create, this never reuses m's current buffer, which may
+    // still be referenced by other frames.
+    void create(cv::Mat_<uint16_t> &m, int rows, int cols);
+    void create(cv::Mat &m, int rows, int cols, int type);
+
+    stats get_stats() const;
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData *data, cv::AccessFlag accessflags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData *data) const override;
+
+private:
+    explicit frame_pool(size_t max_free = 16);
+
+    const size_t max_free;
+    mutable std::mutex mtx;
+    mutable std::vector<cv::UMatData*> free_list;
+    mutable stats st;
+};
+
+#endif // FRAME_POOL_HPP
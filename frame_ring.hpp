@@ -0,0 +1,195 @@
+#ifndef FRAME_RING_HPP
+#define FRAME_RING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring buffer.
+//
+// push() may only be called from one (producer) thread and pop*()
+// from one (consumer) thread. Handing items over is lock-free; the
+// mutex is used only to put a thread to sleep when it has nothing to
+// do (empty ring for the consumer, full ring for a waiting producer).
+template <typename T>
+class spsc_ring {
+public:
+    explicit spsc_ring(size_t capacity) : slots(capacity) {}
+
+    size_t capacity() const { return slots.size(); }
+    size_t size() const { return tail.load() - head.load(); }
+
+    // Store the item if there is a free slot. Returns false when the
+    // ring is full.
+    bool try_push(T &&item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+            return false;
+        slots[t % slots.size()] = std::move(item);
+        tail.store(t + 1); // seq_cst: must not be reordered with wake()
+        wake(consumer_waiting);
+        return true;
+    }
+
+    // Wait (at most timeout) for a free slot and store the item.
+    template <class Rep, class Period>
+    bool push(T &&item, std::chrono::duration<Rep, Period> timeout)
+    {
+        if (try_push(std::move(item)))
+            return true;
+        sleep(producer_waiting, timeout, [&]{ return size() < slots.size() || closed; });
+        return try_push(std::move(item));
+    }
+
+    // Take the oldest item. Waits at most timeout for an item to
+    // arrive.
+    template <class Rep, class Period>
+    bool pop(T &item, std::chrono::duration<Rep, Period> timeout)
+    {
+        if (!wait_nonempty(timeout))
+            return false;
+        size_t h = head.load(std::memory_order_relaxed);
+        item = std::move(slots[h % slots.size()]);
+        slots[h % slots.size()] = T();
+        head.store(h + 1);
+        wake(producer_waiting);
+        return true;
+    }
+
+    // Take the newest item and discard all older ones. The number of
+    // discarded items is added to skipped.
+    template <class Rep, class Period>
+    bool pop_latest(T &item, std::chrono::duration<Rep, Period> timeout, uint64_t &skipped)
+    {
+        if (!wait_nonempty(timeout))
+            return false;
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        for (; h + 1 < t; h++) {
+            slots[h % slots.size()] = T(); // release the skipped item early
+            skipped++;
+        }
+        item = std::move(slots[h % slots.size()]);
+        slots[h % slots.size()] = T();
+        head.store(t);
+        wake(producer_waiting);
+        return true;
+    }
+
+    // Wake up all waiting threads. pop() still returns the remaining
+    // items, but does not wait for new ones.
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            closed = true;
+        }
+        cv.notify_all();
+    }
+
+    bool is_closed() const { return closed; }
+
+private:
+    std::vector<T> slots;
+    alignas(64) std::atomic<size_t> head{0}; // Next item to pop (written by consumer)
+    alignas(64) std::atomic<size_t> tail{0}; // Next free slot (written by producer)
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::atomic<bool> closed{false};
+    std::atomic<bool> consumer_waiting{false};
+    std::atomic<bool> producer_waiting{false};
+
+    // Only take the mutex when the other side announced that it is
+    // (about to go) sleeping.
+    void wake(std::atomic<bool> &waiting)
+    {
+        if (waiting.load()) {
+            { std::lock_guard<std::mutex> lk(mtx); }
+            cv.notify_all();
+        }
+    }
+
+    template <class Rep, class Period, class Pred>
+    void sleep(std::atomic<bool> &waiting, std::chrono::duration<Rep, Period> timeout, Pred ready)
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        waiting.store(true);
+        cv.wait_for(lk, timeout, ready);
+        waiting.store(false);
+    }
+
+    template <class Rep, class Period>
+    bool wait_nonempty(std::chrono::duration<Rep, Period> timeout)
+    {
+        if (size() == 0)
+            sleep(consumer_waiting, timeout, [&]{ return size() > 0 || closed; });
+        return size() > 0;
+    }
+};
+
+// Single slot holding only the newest item. put() replaces an item
+// that was not taken yet, so the consumer never gets a stale one.
+template <typename T>
+class latest_slot {
+public:
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        return full;
+    }
+
+    // Store the item. Returns true if it replaced an item that was not
+    // taken.
+    bool put(T &&item)
+    {
+        bool evicted;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            evicted = full;
+            slot = std::move(item);
+            full = true;
+        }
+        cv.notify_all();
+        return evicted;
+    }
+
+    // Take the item. Waits at most timeout for an item to arrive.
+    template <class Rep, class Period>
+    bool take(T &item, std::chrono::duration<Rep, Period> timeout)
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait_for(lk, timeout, [&]{ return full || closed; });
+        if (!full)
+            return false;
+        item = std::move(slot);
+        slot = T();
+        full = false;
+        return true;
+    }
+
+    // Wake up the waiting consumer (see spsc_ring::close())
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            closed = true;
+        }
+        cv.notify_all();
+    }
+
+    bool is_closed() const { return closed; }
+
+private:
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    T slot;
+    bool full = false;
+    std::atomic<bool> closed{false};
+};
+
+#endif // FRAME_RING_HPP
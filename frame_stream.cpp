@@ -0,0 +1,142 @@
+#include "frame_stream.hpp"
+#include <cstring>
+#include <sstream>
+#include <zlib.h>
+
+using namespace std;
+
+// Append a value in the host byte order (little endian on all
+// supported platforms)
+template <typename T>
+static void put(string &s, T v)
+{
+    s.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+template <typename T>
+static void put_at(string &s, size_t offset, T v)
+{
+    memcpy(&s[offset], &v, sizeof(v));
+}
+
+void frame_stream_encoder::set_options(const string &spec)
+{
+    stringstream ss(spec);
+    string opt;
+    options = 0;
+    while (ss >> opt) {
+        if (opt == "delta")
+            options |= delta;
+        else if (opt == "zlib")
+            options |= zlib;
+    }
+    prev.release();
+}
+
+// Offsets of the header fields that differ between clients
+static const size_t flags_offset = 28, payload_size_offset = 36;
+
+static bool compress(const string &in, string &out)
+{
+    uLongf len = compressBound(in.size());
+    out.assign(len, '\0');
+    if (compress2(reinterpret_cast<Bytef *>(&out[0]), &len,
+                  reinterpret_cast<const Bytef *>(in.data()), in.size(), Z_BEST_SPEED) != Z_OK) {
+        out.clear();
+        return false;
+    }
+    out.resize(len);
+    return true;
+}
+
+shared_ptr<const frame_stream_frame>
+frame_stream_encoder::prepare(uint64_t frame, chrono::system_clock::time_point time, const cv::Mat_<float> &celsius,
+                              const vector<cv::Point2f> &border, const vector<POI> &poi,
+                              const vector<HeatSource> &hs, const vector<cv::Point2f> &hs_pos)
+{
+    CV_Assert(hs_pos.size() == hs.size());
+    auto f = make_shared<frame_stream_frame>();
+    f->frame = frame;
+    celsius.convertTo(f->half, CV_16F);
+
+    // Float16 bit patterns. Differences of them are small for similar
+    // temperatures (the patterns of positive numbers are monotonic),
+    // which makes them compress well.
+    const cv::Mat &half = f->half;
+    f->raw.assign(half.total() * sizeof(uint16_t), '\0');
+    if (!f->raw.empty()) {
+        memcpy(&f->raw[0], half.ptr<uint16_t>(), f->raw.size());
+        compress(f->raw, f->zlib);
+    }
+
+    string &msg = f->header;
+    msg.reserve(64 + 16 * poi.size() + 12 * hs.size());
+    msg.append("TCF1");
+    put<uint32_t>(msg, 0);      // Header size (below)
+    put<uint64_t>(msg, frame);
+    put<int64_t>(msg, chrono::duration_cast<chrono::microseconds>(time.time_since_epoch()).count());
+    put<uint16_t>(msg, half.cols);
+    put<uint16_t>(msg, half.rows);
+    put<uint8_t>(msg, 0);       // Flags (set by encode())
+    put<uint8_t>(msg, border.size());
+    put<uint16_t>(msg, poi.size());
+    put<uint16_t>(msg, hs.size());
+    put<uint16_t>(msg, 0);      // Reserved
+    put<uint32_t>(msg, 0);      // Payload size (set by encode())
+
+    for (const auto &p : border) {
+        put<float>(msg, p.x);
+        put<float>(msg, p.y);
+    }
+    for (const auto &p : poi) {
+        string name = p.name.substr(0, 255);
+        put<float>(msg, p.p.x);
+        put<float>(msg, p.p.y);
+        put<float>(msg, p.temp);
+        put<uint8_t>(msg, name.size());
+        msg.append(name);
+    }
+    for (size_t i = 0; i < hs.size(); i++) {
+        put<float>(msg, hs_pos[i].x);
+        put<float>(msg, hs_pos[i].y);
+        put<float>(msg, hs[i].neg_laplacian);
+    }
+    put_at<uint32_t>(msg, 4, msg.size());
+    return f;
+}
+
+string frame_stream_encoder::encode(const frame_stream_frame &f)
+{
+    const cv::Mat &half = f.half;
+    const string *payload = &f.raw;
+    string delta_payload, z;
+    uint8_t fl = 0;
+
+    if ((options & delta) && !prev.empty() && prev.size() == half.size()) {
+        const size_t n = half.total();
+        const uint16_t *px = half.ptr<uint16_t>(), *pp = prev.ptr<uint16_t>();
+        delta_payload.assign(n * sizeof(uint16_t), '\0');
+        uint16_t *out = reinterpret_cast<uint16_t *>(&delta_payload[0]);
+        for (size_t i = 0; i < n; i++)
+            out[i] = uint16_t(px[i] - pp[i]);
+        payload = &delta_payload;
+        fl |= delta;
+        if ((options & zlib) && compress(delta_payload, z)) {
+            payload = &z;
+            fl |= zlib;
+        }
+    } else if ((options & zlib) && !f.zlib.empty()) {
+        payload = &f.zlib;
+        fl |= zlib;
+    }
+    if (options & delta)
+        prev = half;
+
+    string msg;
+    msg.reserve(f.header.size() + payload->size());
+    msg.append(f.header);
+    put_at<uint8_t>(msg, flags_offset, fl);
+    put_at<uint32_t>(msg, payload_size_offset, payload->size());
+    msg.append(*payload);
+    return msg;
+}
@@ -0,0 +1,54 @@
+#ifndef FRAME_STREAM_HPP
+#define FRAME_STREAM_HPP
+
+#include "thermo_img.hpp"
+#include <opencv2/core/mat.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Parts of a binary frame message that are the same for all clients,
+// prepared once per frame by frame_stream_encoder::prepare()
+struct frame_stream_frame {
+    uint64_t frame;
+    cv::Mat half;               // Image in °C (CV_16F)
+    std::string header;         // Header, border, POI and heat sources
+    std::string raw;            // Whole pixel data
+    std::string zlib;           // Compressed raw (empty if compression failed)
+};
+
+// Encoder of binary websocket messages with temperature images (see
+// "Binary frame stream" in README.md). One encoder per client, because
+// delta compression depends on the frames the client received. Not
+// thread-safe.
+class frame_stream_encoder {
+public:
+    enum flags : uint8_t {
+        delta = 1,              // Pixels are differences to the previous frame
+        zlib = 2,               // Pixels are zlib compressed
+    };
+
+    // Set options from a space separated list of "delta" and "zlib".
+    // The next frame is sent whole.
+    void set_options(const std::string &spec);
+
+    // Convert the image in °C and compress it. hs_pos are the
+    // locations of hs in frame coordinates (see
+    // thermo_img::get_heat_sources_in_frame()).
+    static std::shared_ptr<const frame_stream_frame>
+    prepare(uint64_t frame, std::chrono::system_clock::time_point time, const cv::Mat_<float> &celsius,
+            const std::vector<cv::Point2f> &border, const std::vector<POI> &poi,
+            const std::vector<HeatSource> &hs, const std::vector<cv::Point2f> &hs_pos);
+
+    // Message with the prepared frame for this client. Only delta
+    // frames are compressed here, whole frames use f's payloads.
+    std::string encode(const frame_stream_frame &f);
+
+private:
+    uint8_t options = 0;
+    cv::Mat prev;               // Last encoded image (for delta)
+};
+
+#endif // FRAME_STREAM_HPP
@@ -0,0 +1,273 @@
+#include "hs_kernels.hpp"
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <limits>
+
+using namespace cv;
+
+namespace hs_kernels {
+
+// Uniform access to SIMD vectors of float and double. lanes is zero
+// if the type is not vectorized on this platform.
+template <typename T> struct simd { enum { lanes = 0 }; };
+#if CV_SIMD
+template <> struct simd<float> {
+    using vec = v_float32;
+    enum { lanes = v_float32::nlanes };
+    static vec load(const float *p) { return vx_load(p); }
+    static vec all(float x) { return vx_setall_f32(x); }
+};
+#endif
+#if CV_SIMD_64F
+template <> struct simd<double> {
+    using vec = v_float64;
+    enum { lanes = v_float64::nlanes };
+    static vec load(const double *p) { return vx_load(p); }
+    static vec all(double x) { return vx_setall_f64(x); }
+};
+#endif
+
+// Call f(dst_row, src_row, n) for all rows, or only once for
+// continuous matrices
+template <typename T, typename F>
+static void for_rows(Mat_<T> &dst, const Mat_<T> &src, F f)
+{
+    int rows = dst.rows, cols = dst.cols;
+    if (dst.isContinuous() && src.isContinuous()) {
+        cols *= rows;
+        rows = 1;
+    }
+    for (int y = 0; y < rows; y++)
+        f(dst[y], src[y], cols);
+}
+
+template <typename T>
+ema_bank<T>::ema_bank(const std::vector<double> &alphas, double init)
+    : alphas(alphas)
+    , init(init)
+    , avgs(alphas.size())
+    , mins(alphas.size() + 1)
+    , maxs(alphas.size() + 1)
+{
+    CV_Assert(!alphas.empty() && alphas.size() <= max_size);
+}
+
+template <typename T>
+void ema_bank<T>::update(const Mat_<T> &x)
+{
+    const int K = alphas.size();
+    bool continuous = x.isContinuous();
+    for (auto &avg : avgs) {
+        if (avg.size() != x.size()) {
+            avg.create(x.size());
+            avg = T(init);
+        }
+        continuous = continuous && avg.isContinuous();
+    }
+    int rows = x.rows, cols = x.cols;
+    if (continuous) {
+        cols *= rows;
+        rows = 1;
+    }
+
+    // Per-average constants and results; index K is the input
+    T a[max_size], b[max_size];
+    T lo[max_size + 1], hi[max_size + 1];
+    for (int k = 0; k < K; k++) {
+        a[k] = alphas[k];
+        b[k] = 1 - alphas[k];
+    }
+    for (int k = 0; k <= K; k++) {
+        lo[k] = std::numeric_limits<T>::max();
+        hi[k] = std::numeric_limits<T>::lowest();
+    }
+
+    for (int y = 0; y < rows; y++) {
+        const T *s = x[y];
+        T *d[max_size];
+        for (int k = 0; k < K; k++)
+            d[k] = avgs[k][y];
+
+        int i = 0;
+        if constexpr (simd<T>::lanes > 0) {
+            using S = simd<T>;
+            using V = typename S::vec;
+            V va[max_size], vb[max_size], vlo[max_size + 1], vhi[max_size + 1];
+            for (int k = 0; k < K; k++) {
+                va[k] = S::all(a[k]);
+                vb[k] = S::all(b[k]);
+            }
+            for (int k = 0; k <= K; k++) {
+                vlo[k] = S::all(lo[k]);
+                vhi[k] = S::all(hi[k]);
+            }
+            for (; i + S::lanes <= cols; i += S::lanes) {
+                V v = S::load(s + i);
+                vlo[K] = v_min(vlo[K], v);
+                vhi[K] = v_max(vhi[K], v);
+                for (int k = 0; k < K; k++) {
+                    V r = v_fma(S::load(d[k] + i), va[k], v * vb[k]);
+                    v_store(d[k] + i, r);
+                    vlo[k] = v_min(vlo[k], r);
+                    vhi[k] = v_max(vhi[k], r);
+                }
+            }
+            T tmp[S::lanes];
+            for (int k = 0; k <= K; k++) {
+                v_store(tmp, vlo[k]);
+                lo[k] = *std::min_element(tmp, tmp + S::lanes);
+                v_store(tmp, vhi[k]);
+                hi[k] = *std::max_element(tmp, tmp + S::lanes);
+            }
+        }
+        for (; i < cols; i++) {
+            T v = s[i];
+            lo[K] = std::min(lo[K], v);
+            hi[K] = std::max(hi[K], v);
+            for (int k = 0; k < K; k++) {
+                T r = d[k][i] * a[k] + v * b[k];
+                d[k][i] = r;
+                lo[k] = std::min(lo[k], r);
+                hi[k] = std::max(hi[k], r);
+            }
+        }
+    }
+
+    for (int k = 0; k <= K; k++) {
+        mins[k] = lo[k];
+        maxs[k] = hi[k];
+    }
+}
+
+// Vectorized part of an ema() row: d = init ? v : d * a + v * b with
+// v = s - c. Returns the number of processed pixels; the rest is left
+// to the scalar loop.
+template <typename T>
+static int ema_row_simd(T *, const uint16_t *, const T *, int, T, T, bool)
+{
+    return 0;
+}
+#if CV_SIMD
+static int ema_row_simd(float *d, const uint16_t *s, const float *c, int n, float a, float b, bool init)
+{
+    const int L = v_float32::nlanes;
+    const v_float32 va = vx_setall_f32(a), vb = vx_setall_f32(b);
+    int i = 0;
+    for (; i + L <= n; i += L) {
+        v_float32 v = v_cvt_f32(v_reinterpret_as_s32(vx_load_expand(s + i)));
+        if (c)
+            v = v - vx_load(c + i);
+        v_store(d + i, init ? v : v_fma(vx_load(d + i), va, v * vb));
+    }
+    return i;
+}
+#endif
+#if CV_SIMD_64F
+static int ema_row_simd(double *d, const uint16_t *s, const double *c, int n, double a, double b, bool init)
+{
+    // One load of 16-bit pixels fills two double vectors
+    const int L = v_float64::nlanes;
+    const v_float64 va = vx_setall_f64(a), vb = vx_setall_f64(b);
+    int i = 0;
+    for (; i + 2 * L <= n; i += 2 * L) {
+        v_int32 w = v_reinterpret_as_s32(vx_load_expand(s + i));
+        v_float64 v[2] = { v_cvt_f64(w), v_cvt_f64_high(w) };
+        for (int h = 0; h < 2; h++) {
+            double *dh = d + i + h * L;
+            if (c)
+                v[h] = v[h] - vx_load(c + i + h * L);
+            v_store(dh, init ? v[h] : v_fma(vx_load(dh), va, v[h] * vb));
+        }
+    }
+    return i;
+}
+#endif
+
+template <typename T>
+void ema(Mat_<T> &avg, const Mat_<uint16_t> &x, const Mat_<T> &sub, double alpha)
+{
+    CV_Assert(sub.empty() || sub.size() == x.size());
+    const T a = alpha, b = 1 - alpha;
+    bool init = avg.size() != x.size();
+    avg.create(x.size());
+    int rows = x.rows, cols = x.cols;
+    if (x.isContinuous() && avg.isContinuous() && (sub.empty() || sub.isContinuous())) {
+        cols *= rows;
+        rows = 1;
+    }
+    for (int y = 0; y < rows; y++) {
+        const uint16_t *s = x[y];
+        const T *c = sub.empty() ? nullptr : sub[y];
+        T *d = avg[y];
+        int i = ema_row_simd(d, s, c, cols, a, b, init);
+        for (; i < cols; i++) {
+            T v = c ? s[i] - c[i] : s[i];
+            d[i] = init ? v : d[i] * a + v * b;
+        }
+    }
+}
+
+template <typename T>
+void remap_sub(const Mat_<uint16_t> &src, const Mat &xy, const Mat &frac,
+               const Mat_<T> &sub, Mat_<T> &out)
+{
+    CV_Assert(xy.type() == CV_16SC2 && frac.type() == CV_16UC1 && xy.size() == frac.size());
+    CV_Assert(sub.empty() || sub.size() == xy.size());
+    const T scale = T(1) / INTER_TAB_SIZE;
+    auto pixel = [&src](int x, int y) -> T {
+        return x >= 0 && x < src.cols && y >= 0 && y < src.rows ? src(y, x) : 0;
+    };
+
+    out.create(xy.size());
+    for (int y = 0; y < out.rows; y++) {
+        const short *p = xy.ptr<short>(y);
+        const ushort *f = frac.ptr<ushort>(y);
+        const T *c = sub.empty() ? nullptr : sub[y];
+        T *d = out[y];
+        for (int x = 0; x < out.cols; x++) {
+            int sx = p[2 * x], sy = p[2 * x + 1];
+            T fx = (f[x] & (INTER_TAB_SIZE - 1)) * scale;
+            T fy = (f[x] >> INTER_BITS) * scale;
+            T v00, v01, v10, v11;
+            if (sx >= 0 && sx + 1 < src.cols && sy >= 0 && sy + 1 < src.rows) {
+                const uint16_t *r0 = &src(sy, sx), *r1 = &src(sy + 1, sx);
+                v00 = r0[0]; v01 = r0[1]; v10 = r1[0]; v11 = r1[1];
+            } else {
+                v00 = pixel(sx, sy); v01 = pixel(sx + 1, sy);
+                v10 = pixel(sx, sy + 1); v11 = pixel(sx + 1, sy + 1);
+            }
+            T top = v00 + (v01 - v00) * fx;
+            T bottom = v10 + (v11 - v10) * fx;
+            d[x] = top + (bottom - top) * fy - (c ? c[x] : 0);
+        }
+    }
+}
+
+template <typename T>
+void positive_part(const Mat_<T> &x, T offset, Mat_<T> &out)
+{
+    out.create(x.size());
+    for_rows(out, x, [offset](T *d, const T *s, int n) {
+        int i = 0;
+        if constexpr (simd<T>::lanes > 0) {
+            using S = simd<T>;
+            const typename S::vec voff = S::all(offset), zero = S::all(0);
+            for (; i + S::lanes <= n; i += S::lanes)
+                v_store(d + i, v_max(S::load(s + i) - voff, zero));
+        }
+        for (; i < n; i++)
+            d[i] = std::max(s[i] - offset, T(0));
+    });
+}
+
+template class ema_bank<float>;
+template class ema_bank<double>;
+template void ema<float>(Mat_<float> &, const Mat_<uint16_t> &, const Mat_<float> &, double);
+template void ema<double>(Mat_<double> &, const Mat_<uint16_t> &, const Mat_<double> &, double);
+template void remap_sub<float>(const Mat_<uint16_t> &, const Mat &, const Mat &, const Mat_<float> &, Mat_<float> &);
+template void remap_sub<double>(const Mat_<uint16_t> &, const Mat &, const Mat &, const Mat_<double> &, Mat_<double> &);
+template void positive_part<float>(const Mat_<float> &, float, Mat_<float> &);
+template void positive_part<double>(const Mat_<double> &, double, Mat_<double> &);
+
+}
@@ -0,0 +1,71 @@
+#ifndef HS_KERNELS_HPP
+#define HS_KERNELS_HPP
+
+#include <opencv2/core/mat.hpp>
+#include <vector>
+
+// Per-pixel kernels of the heat source calculation. They are
+// vectorized with OpenCV universal intrinsics (with a scalar
+// fallback for platforms without SIMD) and implemented for float and
+// double images. They work in place and allocate only when the
+// output does not have the right size yet.
+namespace hs_kernels {
+
+// Several exponential moving averages of the same sequence of
+// images, avg_k = alpha_k * avg_k + (1 - alpha_k) * x, updated in a
+// single pass over the input. The value range of the input and of
+// every average is found during the update, so no separate
+// cv::minMaxLoc() is needed.
+template <typename T>
+class ema_bank {
+public:
+    static constexpr size_t max_size = 8;
+
+    // The averages start at init. They are allocated by the first
+    // update() (with the size of its input).
+    explicit ema_bank(const std::vector<double> &alphas, double init = 0);
+
+    void update(const cv::Mat_<T> &x);
+
+    size_t size() const { return alphas.size(); }
+    double alpha(size_t k) const { return alphas[k]; }
+    const cv::Mat_<T> &avg(size_t k) const { return avgs[k]; }
+
+    // Value range of average k after the last update()
+    double min(size_t k) const { return mins[k]; }
+    double max(size_t k) const { return maxs[k]; }
+
+    // Value range of the input of the last update()
+    double input_min() const { return mins[size()]; }
+    double input_max() const { return maxs[size()]; }
+
+private:
+    std::vector<double> alphas;
+    double init;
+    std::vector<cv::Mat_<T>> avgs;
+    std::vector<double> mins, maxs; // [size()] is for the input
+};
+
+// Exponential moving average of a 16-bit image minus sub (if not
+// empty): avg = alpha * avg + (1 - alpha) * (x - sub). The input is
+// converted to T on the fly. If avg has a different size than x, it
+// is initialized to x - sub.
+template <typename T>
+void ema(cv::Mat_<T> &avg, const cv::Mat_<uint16_t> &x, const cv::Mat_<T> &sub, double alpha);
+
+// Bilinear interpolation of a 16-bit image at positions given by
+// fixed-point maps from cv::convertMaps() (CV_16SC2 and CV_16UC1),
+// minus sub (if not empty). Pixels outside of src are zero, as with
+// cv::BORDER_CONSTANT. Equivalent to converting src to T and calling
+// cv::remap(), but only the output pixels are calculated.
+template <typename T>
+void remap_sub(const cv::Mat_<uint16_t> &src, const cv::Mat &xy, const cv::Mat &frac,
+               const cv::Mat_<T> &sub, cv::Mat_<T> &out);
+
+// out = max(x - offset, 0)
+template <typename T>
+void positive_part(const cv::Mat_<T> &x, T offset, cv::Mat_<T> &out);
+
+}
+
+#endif // HS_KERNELS_HPP
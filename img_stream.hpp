@@ -1,60 +1,92 @@
 #ifndef IMG_STREAM_HPP
 #define IMG_STREAM_HPP
 
-#ifdef WITH_WIC_SDK
-#include <wic/calibrationdata.h>
-#include <wic/camerafinder.h>
-#include <wic/framegrabber.h>
-#include <wic/wic.h>
-#endif
-#include <opencv2/videoio.hpp>
+#include "camera_source.hpp"
+#include "synthetic_camera.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <utility>
 #include <string>
 
-// The colors 0-255 in recordings correspond to temperatures 15-120C
-#define RECORD_MIN_C 15
-#define RECORD_MAX_C 120
-
-// TODO: Split this class to camera dependent and independent parts.
-// Ideally we want to support different thermal cameras.
-
+// Camera independent part of image acquisition. Selects the
+// camera_source implementation according to the command line and
+// keeps the state common to all of them.
+//
+// Camera component temperatures are read by a background thread,
+// because reading them from the camera takes long and would delay
+// grabbing of images.
 struct img_stream {
 public:
-    img_stream(std::string vid_in_path, std::string license_file);
+    // If synthetic is given, images are generated by synthetic_camera
+    // instead of being read from the camera or vid_in_path.
+    img_stream(std::string vid_in_path, std::string license_file,
+               const synthetic_camera::params *synthetic = nullptr);
     ~img_stream();
 
-    std::vector<std::pair<std::string, double>> getCameraComponentTemps();
+    // The last temperatures read by the background thread. Does not
+    // block; a new snapshot (pointer) is returned after every reading.
+    std::shared_ptr<const camera_temps> getCameraComponentTemps() const { return src->get_component_temps(); }
+
+    // Returns false at the end of video or raw recording (if looping
+    // is disabled by set_loop()).
+    bool get_image(cv::Mat_<uint16_t> &result) { return src->get_image(result, image_time); }
+
+    // Whether to restart video, raw recording replay or synthetic
+    // images after reaching its end (default: true)
+    void set_loop(bool loop) { src->set_loop(loop); }
 
-    void get_image(cv::Mat_<uint16_t> &result);
+    // Whether synthetic images are generated at their frame rate
+    // (default) or as fast as possible
+    void set_realtime(bool realtime) { src->set_realtime(realtime); }
+
+    // Time when the last image was grabbed. For raw recordings, this
+    // is the recorded time.
+    std::chrono::system_clock::time_point get_image_time() const { return image_time; }
+
+    // Continue video or raw recording replay at the given frame
+    void seek(size_t frame) { src->seek(frame); }
 
     double get_temperature(uint16_t pixel_value);
 
+    // Current raw → °C conversion table. It is replaced (not
+    // modified) when the camera changes the temperature resolution,
+    // so frames can keep the table valid at the time of grabbing.
+    std::shared_ptr<const temp_lut> get_lut() const { return src->get_lut(); }
+
+    void to_celsius(const cv::Mat_<uint16_t> &raw, cv::Mat_<float> &celsius) const;
+
+    camera_source::capabilities get_capabilities() const { return src->get_capabilities(); }
+
+    // Whether the images come from a camera in real time
+    bool is_live() const { return src->get_capabilities().live; }
+
 private:
-    char tmp; // To make #ifdef in constructor simpler
-#ifdef WITH_WIC_SDK
-    const
-#else
-    static constexpr
-#endif
-    bool is_video = true;
-    cv::VideoCapture *video = nullptr;
-#ifdef WITH_WIC_SDK
-    wic::LicenseFile license;
-    wic::WIC *wic = nullptr;
-    wic::FrameGrabber *grabber = nullptr;
-#endif
+    std::unique_ptr<camera_source> src;
+    std::chrono::system_clock::time_point image_time;
+
+    // Period of reading camera component temperatures
+    // All component temperatures are read once a minute, the sensor
+    // temperature (needed for calibration) more often
+    static constexpr std::chrono::seconds telemetry_period{60};
+    static constexpr std::chrono::seconds sensor_period{5};
+    std::thread telemetry;
+    std::mutex telemetry_mtx;
+    std::condition_variable telemetry_cv;
+    bool telemetry_stop = false;
+
+    void telemetry_loop();
+
+    static camera_source *open_source(const std::string &vid_in_path, const std::string &license_file,
+                                      const synthetic_camera::params *synthetic);
 
 public:
+    // Raw values of RECORD_MIN_C and RECORD_MAX_C (range of 8-bit images)
     const uint16_t min_rawtemp; // must be initialized after camera
     const uint16_t max_rawtemp;
-
-private:
-#ifdef WITH_WIC_SDK
-    wic::WIC *init_wic();
-    wic::FrameGrabber *init_grabber();
-#endif
-    uint16_t findRawtempC(double temp);
 };
 
 #endif // IMG_STREAM_HPP
@@ -0,0 +1,70 @@
+#include "latency.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+const char *const frame_stamps::names[count] = {
+    "grab", "update", "track", "heat_sources", "preview", "webserver", "broadcast"
+};
+
+int latency_histogram::bucket(chrono::nanoseconds d)
+{
+    double us = d.count() / 1e3;
+    if (us <= 1)
+        return 0;
+    return min(buckets - 1, int(4 * log2(us)) + 1);
+}
+
+double latency_histogram::upper_bound(int bucket)
+{
+    return exp2(bucket / 4.0) * 1e-6;
+}
+
+void latency_histogram::add(chrono::nanoseconds d)
+{
+    d = max(d, chrono::nanoseconds(0));
+    int b = bucket(d);
+
+    lock_guard<mutex> lk(mtx);
+    if (curr_n >= window) {
+        prev = curr;
+        curr.fill(0);
+        curr_n = 0;
+    }
+    curr[b]++;
+    curr_n++;
+    total_n++;
+    total_sum += d;
+}
+
+double latency_histogram::quantile(double q) const
+{
+    lock_guard<mutex> lk(mtx);
+    uint64_t n = 0;
+    for (int i = 0; i < buckets; i++)
+        n += curr[i] + prev[i];
+    if (n == 0)
+        return NAN;
+
+    uint64_t rank = max<uint64_t>(1, ceil(q * n));
+    uint64_t cum = 0;
+    for (int i = 0; i < buckets; i++) {
+        cum += curr[i] + prev[i];
+        if (cum >= rank)
+            return upper_bound(i);
+    }
+    return upper_bound(buckets - 1);
+}
+
+double latency_histogram::sum() const
+{
+    lock_guard<mutex> lk(mtx);
+    return chrono::duration<double>(total_sum).count();
+}
+
+uint64_t latency_histogram::count() const
+{
+    lock_guard<mutex> lk(mtx);
+    return total_n;
+}
@@ -0,0 +1,68 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// Times when a frame passed the individual processing stages. The
+// stamps travel with the frame (in thermo_img), so they remain valid
+// when the frame is processed by other threads.
+struct frame_stamps {
+    enum stage {
+        grab,           // Acquisition by the capture thread
+        update,
+        track,
+        heat_sources,
+        preview,
+        webserver,      // Stored in the webserver
+        broadcast,      // Sent to websocket clients
+        count
+    };
+    static const char *const names[count];
+
+    std::array<std::chrono::steady_clock::time_point, count> t {};
+
+    void stamp(stage s, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) { t[s] = now; }
+
+    // Time spent in stage s, i.e. since the previous stamp
+    std::chrono::nanoseconds stage_latency(stage s) const { return t[s] - t[s > 0 ? s - 1 : 0]; }
+
+    // Time from acquisition to stamp s
+    std::chrono::nanoseconds latency(stage s) const { return t[s] - t[grab]; }
+};
+
+// Distribution of latencies with logarithmic buckets (about 19 %
+// wide, from 1 µs to over an hour). Quantiles are calculated from
+// the recent values only (between window and 2*window of them), so
+// that regressions show up quickly even after a long uptime. Sum and
+// count cover all values, as Prometheus expects for summaries.
+class latency_histogram {
+public:
+    explicit latency_histogram(uint64_t window = 1000) : window(window) {}
+
+    void add(std::chrono::nanoseconds d);
+
+    // Quantile q (0–1) of the recent values [s]. NaN if there are none.
+    double quantile(double q) const;
+
+    double sum() const;         // [s]
+    uint64_t count() const;
+
+private:
+    static constexpr int buckets = 128;
+    using counts = std::array<uint64_t, buckets>;
+
+    const uint64_t window;
+    mutable std::mutex mtx;
+    counts curr {}, prev {};    // Current and previous window
+    uint64_t curr_n = 0;
+    uint64_t total_n = 0;
+    std::chrono::nanoseconds total_sum {0};
+
+    static int bucket(std::chrono::nanoseconds d);
+    static double upper_bound(int bucket);
+};
+
+#endif // LATENCY_HPP
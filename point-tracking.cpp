@@ -1,5 +1,10 @@
 #include "point-tracking.hpp"
+#include <opencv2/video/tracking.hpp>
 #include <err.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
 #include <iostream>
 
 // knnMatchImpl is protected in FlannBasedMatcher, only knnMatch is public.
@@ -10,82 +15,233 @@
 // Thus, this ugly hack, to be able to use knnMatchImpl and train only once.
 class MyFlann : public cv::FlannBasedMatcher {
 public:
+    using cv::FlannBasedMatcher::FlannBasedMatcher;
     void knnMatchImpl(const cv::Mat& queryDescriptors, std::vector<std::vector<cv::DMatch>>& matches, int knn) {cv::FlannBasedMatcher::knnMatchImpl(queryDescriptors,matches,knn);}
 };
 
-MyFlann matcher;
-cv::Ptr<cv::FastFeatureDetector> fast = nullptr;
-cv::Ptr<cv::BRISK> brisk = nullptr;
+point_tracker::point_tracker(const cv::Mat &gray, const tracking_params &params)
+    : fast(cv::FastFeatureDetector::create(18, false))
+    , brisk(cv::BRISK::create(0, 0, 1.8))
+    , params(params)
+{
+    cv::Mat pre = preprocess(gray);
+    ref_kp = detect(pre);
+    ref_desc = describe(pre, ref_kp);
 
-std::vector<cv::KeyPoint> getKeyPoints(cv::Mat A) {
-    if (!fast) fast = cv::FastFeatureDetector::create(18, false);
+    switch (params.matcher) {
+    case matcher_type::flann: {
+        cv::Mat desc_train;
+        ref_desc.convertTo(desc_train, CV_32F);
+        flann = cv::makePtr<MyFlann>();
+        flann->add({desc_train});
+        flann->train();
+        break;
+    }
+    case matcher_type::lsh:
+        // Hash tables are built once here, queries probe neighbouring buckets too
+        flann = cv::makePtr<MyFlann>(cv::makePtr<cv::flann::LshIndexParams>(12, 20, 2));
+        flann->add({ref_desc});
+        flann->train();
+        break;
+    case matcher_type::hamming:
+        bf = cv::BFMatcher::create(cv::NORM_HAMMING);
+        break;
+    }
+}
+
+point_tracker::~point_tracker() = default;
+
+std::vector<cv::KeyPoint> point_tracker::detect(const cv::Mat &pre)
+{
     std::vector<cv::KeyPoint> kp;
-    fast->detect(A, kp);
+    fast->detect(pre, kp);
     return kp;
 }
 
-// getDescriptors changes the KeyPoint vector, as it removes keypoints which are
-// impossible to calculate a keypoint from (too close to image border, etc.).
-// Thus kp should always be passed as a non-const reference.
-cv::Mat getDescriptors(cv::Mat A, std::vector<cv::KeyPoint>& kp)
+cv::Mat point_tracker::describe(const cv::Mat &pre, std::vector<cv::KeyPoint> &kp)
 {
     cv::Mat desc;
-    if (!brisk) brisk = cv::BRISK::create(0,0,1.8);
-    brisk->compute(A, kp, desc);
+    brisk->compute(pre, kp, desc);
     return desc;
 }
 
-void trainMatcher(cv::Mat desc_train)
-{
-    desc_train.convertTo(desc_train, CV_32F);
-    matcher.add({desc_train});
-    matcher.train();
-}
-
-std::vector<cv::DMatch> matchToReference(cv::Mat desc_query)
+std::vector<cv::DMatch> point_tracker::match(const cv::Mat &desc_query) const
 {
     std::vector<std::vector<cv::DMatch>> matches;
-    cv::Mat _desc_query;
-    desc_query.convertTo(_desc_query, CV_32F);
-    if(matcher.empty())
-        err(1,"Cannot match, matcher not trained with reference image!");
-    matcher.knnMatchImpl(_desc_query,matches,2);
+    switch (params.matcher) {
+    case matcher_type::flann: {
+        cv::Mat _desc_query;
+        desc_query.convertTo(_desc_query, CV_32F);
+        flann->knnMatchImpl(_desc_query,matches,2);
+        break;
+    }
+    case matcher_type::lsh:
+        flann->knnMatchImpl(desc_query,matches,2);
+        break;
+    case matcher_type::hamming:
+        // The const variant with explicit train descriptors
+        bf->knnMatch(desc_query,ref_desc,matches,2);
+        break;
+    }
 
     // Select good matches
     double thresh = 0.88;
     std::vector<cv::DMatch> good_matches;
     for (size_t i = 0; i < matches.size(); i++) {
+        // LSH may find less than two neighbours
+        if (matches[i].size() < 2)
+            continue;
         if (matches[i][0].distance < thresh * matches[i][1].distance)
             good_matches.push_back(matches[i][0]);
     }
     return good_matches;
 }
 
+// Reprojection threshold [px]
+static const double h_threshold = 6;
+
+// Count correspondences consistent with H
+static int countInliers(const cv::Matx33d &H, const std::vector<cv::Point2f> &from,
+                        const std::vector<cv::Point2f> &to, std::vector<uchar> &mask)
+{
+    int n = 0;
+    for (size_t i = 0; i < from.size(); i++) {
+        double x = from[i].x, y = from[i].y;
+        double w = H(2, 0) * x + H(2, 1) * y + H(2, 2);
+        double dx = (H(0, 0) * x + H(0, 1) * y + H(0, 2)) / w - to[i].x;
+        double dy = (H(1, 0) * x + H(1, 1) * y + H(1, 2)) / w - to[i].y;
+        mask[i] = dx * dx + dy * dy < h_threshold * h_threshold;
+        n += mask[i];
+    }
+    return n;
+}
+
+// RANSAC with a time budget. It stops when the budget is spent or
+// when the best hypothesis has the required confidence, which comes
+// fast for high inlier ratios. The previous homography is tried first
+// and accepted without sampling if it fits most correspondences. The
+// random generator is seeded identically for every call, so the
+// result is deterministic unless the budget runs out.
+static cv::Mat budgetedH(const std::vector<cv::Point2f> &from, const std::vector<cv::Point2f> &to,
+                         double budget_ms, const cv::Mat &prev, homography_stats &st)
+{
+    const double confidence = 0.999;
+    const double warm_ratio = 0.8; // Inlier ratio accepting the previous homography
+    const int n = from.size();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double, std::milli>(budget_ms);
+
+    std::vector<uchar> mask(n), best_mask(n);
+    cv::Matx33d best_H;
+    int best = 0;
+    auto needed_iterations = [&](int inliers) {
+        if (inliers == 0)
+            return INT_MAX;
+        double w4 = std::pow(double(inliers) / n, 4);
+        if (w4 >= 1)
+            return 0;
+        double k = std::log(1 - confidence) / std::log(1 - w4);
+        return k < INT_MAX ? int(std::ceil(k)) : INT_MAX;
+    };
+
+    if (!prev.empty()) {
+        best_H = cv::Matx33d(prev);
+        best = countInliers(best_H, from, to, best_mask);
+        st.warm_start = best >= warm_ratio * n;
+    }
+
+    cv::RNG rng(0x7ac4);
+    int max_iter = st.warm_start ? 0 : needed_iterations(best);
+    int it = 0;
+    for (; it < max_iter && std::chrono::steady_clock::now() < deadline; it++) {
+        int idx[4];
+        for (int i = 0; i < 4; i++) {
+            bool dup;
+            do {
+                idx[i] = rng.uniform(0, n);
+                dup = std::find(idx, idx + i, idx[i]) != idx + i;
+            } while (dup);
+        }
+        cv::Point2f s[4], d[4];
+        for (int i = 0; i < 4; i++) {
+            s[i] = from[idx[i]];
+            d[i] = to[idx[i]];
+        }
+        cv::Matx33d H(cv::getPerspectiveTransform(s, d));
+        if (std::abs(cv::determinant(H)) < 1e-9) // Degenerate sample
+            continue;
+        int c = countInliers(H, from, to, mask);
+        if (c > best) {
+            best = c;
+            best_H = H;
+            mask.swap(best_mask);
+            max_iter = std::min(max_iter, needed_iterations(best));
+        }
+    }
+    st.iterations = it;
+    if (best < 4)
+        return cv::Mat();
+
+    // Least squares refinement on the inliers
+    std::vector<cv::Point2f> in_from, in_to;
+    for (int i = 0; i < n; i++) {
+        if (best_mask[i]) {
+            in_from.push_back(from[i]);
+            in_to.push_back(to[i]);
+        }
+    }
+    cv::Mat H = findHomography(in_from, in_to, 0);
+    if (H.empty())
+        H = cv::Mat(best_H);
+    st.inliers = countInliers(cv::Matx33d(H), from, to, mask);
+    return H;
+}
+
 cv::Mat findH(const std::vector<cv::KeyPoint> &kp_from,
               const std::vector<cv::KeyPoint> &kp_to,
-              const std::vector<cv::DMatch> &matches)
+              const std::vector<cv::DMatch> &matches,
+              double budget_ms,
+              homography_stats *stats,
+              const cv::Mat &prev)
 {
+    auto start = std::chrono::steady_clock::now();
+    homography_stats st;
+    st.matches = matches.size();
+    cv::Mat H;
+
     // FLANN keypoint matching
-    if (matches.size() < 4) // Cannot calculate homography
-        return cv::Mat();
+    if (matches.size() >= 4) { // Otherwise we cannot calculate homography
+        std::vector<cv::Point2f> toP(matches.size()), fromP(matches.size());
+        for (size_t i = 0; i < matches.size(); i++) {
+            toP[i] = kp_to[matches[i].queryIdx].pt;
+            fromP[i] = kp_from[matches[i].trainIdx].pt;
+        }
 
-    std::vector<cv::Point2f> toP(matches.size()), fromP(matches.size());
-    for (size_t i = 0; i < matches.size(); i++) {
-        toP[i] = kp_to[matches[i].queryIdx].pt;
-        fromP[i] = kp_from[matches[i].trainIdx].pt;
+        if (budget_ms > 0) {
+            H = budgetedH(fromP, toP, budget_ms, prev, st);
+        } else {
+            cv::UsacParams params;
+            params.threshold = h_threshold;
+            params.sampler = cv::SamplingMethod::SAMPLING_UNIFORM;
+            params.loSampleSize = 12;
+            params.loMethod = cv::LocalOptimMethod::LOCAL_OPTIM_INNER_AND_ITER_LO;
+            params.score = cv::ScoreMethod::SCORE_METHOD_MSAC;
+            // Ridiculously high required confidence, so maxIterations is always reached
+            // for more deterministic runtime
+            params.confidence = 0.9999999999999999999;
+            params.maxIterations = 90000;
+            cv::Mat mask;
+            H = findHomography(fromP, toP, mask, params);
+            if (!H.empty()) {
+                st.inliers = cv::countNonZero(mask);
+                st.iterations = params.maxIterations;
+            }
+        }
     }
 
-    cv::UsacParams params;
-    params.threshold = 6;
-    params.sampler = cv::SamplingMethod::SAMPLING_UNIFORM;
-    params.loSampleSize = 12;
-    params.loMethod = cv::LocalOptimMethod::LOCAL_OPTIM_INNER_AND_ITER_LO;
-    params.score = cv::ScoreMethod::SCORE_METHOD_MSAC;
-    // Ridiculously high required confidence, so maxIterations is always reached
-    // for more deterministic runtime
-    params.confidence = 0.9999999999999999999;
-    params.maxIterations = 90000;
-    return findHomography(fromP, toP, cv::noArray(), params);
+    st.time_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (stats)
+        *stats = st;
+    return H;
 }
 
 cv::Mat preprocess(cv::Mat input)
@@ -101,3 +257,84 @@ cv::Mat preprocess(cv::Mat input)
     cv::addWeighted(im, 1.5, sh, -0.5, 0, sh);
     return im;
 }
+
+frame_tracker::frame_tracker(std::shared_ptr<point_tracker> ref)
+    : ref(std::move(ref))
+{
+    if (!this->ref)
+        errx(1, "Cannot track, matcher not trained with reference image!");
+}
+
+cv::Mat frame_tracker::track(const cv::Mat &gray, homography_stats *stats)
+{
+    const tracking_params &p = ref->get_params();
+    homography_stats st;
+    cv::Mat newH;
+    if (p.klt_interval > 1 && !H.empty() && since_full + 1 < p.klt_interval) {
+        newH = propagate(gray, st);
+        if (!newH.empty())
+            since_full++;
+    }
+    if (newH.empty()) {
+        st = homography_stats();
+        cv::Mat pre = preprocess(gray);
+        std::vector<cv::KeyPoint> kp = ref->detect(pre);
+        cv::Mat desc = ref->describe(pre, kp);
+        newH = findH(ref->reference_keypoints(), kp, ref->match(desc), p.budget_ms, &st, H);
+        since_full = 0;
+        if (p.klt_interval > 1 && !newH.empty()) {
+            prev_gray = gray;
+            cv::goodFeaturesToTrack(gray, prev_pts, 200, 0.01, 10);
+            initial_pts = prev_pts.size();
+        }
+    }
+    H = newH;
+    if (stats)
+        *stats = st;
+    return newH;
+}
+
+// Homography of gray obtained from the previous one by optical flow.
+// Empty if too few corners were tracked consistently.
+cv::Mat frame_tracker::propagate(const cv::Mat &gray, homography_stats &st)
+{
+    const size_t min_pts = 12;
+    auto start = std::chrono::steady_clock::now();
+    if (prev_pts.size() < min_pts || prev_gray.size() != gray.size())
+        return cv::Mat();
+
+    std::vector<cv::Point2f> next;
+    std::vector<uchar> status;
+    std::vector<float> err;
+    cv::calcOpticalFlowPyrLK(prev_gray, gray, prev_pts, next, status, err, cv::Size(21, 21), 3);
+    std::vector<cv::Point2f> from, to;
+    for (size_t i = 0; i < status.size(); i++) {
+        if (status[i]) {
+            from.push_back(prev_pts[i]);
+            to.push_back(next[i]);
+        }
+    }
+    st.matches = from.size();
+    if (from.size() < min_pts)
+        return cv::Mat();
+
+    // Frame to frame motion is small and most points move consistently,
+    // so plain RANSAC finishes quickly
+    std::vector<uchar> mask;
+    cv::Mat F = findHomography(from, to, cv::RANSAC, 3, mask);
+    if (F.empty())
+        return cv::Mat();
+    st.inliers = cv::countNonZero(mask);
+    // Quality degraded: fall back to full matching
+    if (size_t(st.inliers) < std::max(min_pts, initial_pts / 2))
+        return cv::Mat();
+
+    prev_gray = gray;
+    prev_pts.clear();
+    for (size_t i = 0; i < to.size(); i++)
+        if (mask[i])
+            prev_pts.push_back(to[i]);
+    st.klt = true;
+    st.time_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return F * H;
+}
@@ -7,14 +7,117 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/calib3d.hpp>
+#include <memory>
 
-std::vector<cv::KeyPoint> getKeyPoints(cv::Mat A);
-cv::Mat getDescriptors(cv::Mat A, std::vector<cv::KeyPoint>& kp);
-void trainMatcher(cv::Mat desc_train);
-std::vector<cv::DMatch> matchToReference(cv::Mat desc_query);
+// Methods of matching BRISK descriptors to the reference image
+enum class matcher_type {
+    flann,      // KD-tree on descriptors converted to float
+    hamming,    // Brute force Hamming distance (SIMD popcount)
+    lsh,        // Multi-probe LSH index of the binary descriptors
+};
+
+// How findH() found the homography
+struct homography_stats {
+    int matches = 0;            // Input correspondences
+    int inliers = 0;
+    int iterations = 0;         // Evaluated hypotheses
+    bool warm_start = false;    // The previous homography was good enough
+    bool klt = false;           // Propagated by optical flow (frame_tracker)
+    double time_ms = 0;
+};
+
+// Configuration of point tracking (see point_tracker)
+struct tracking_params {
+    matcher_type matcher = matcher_type::flann;
+    // Time budget of findH() [ms]. With zero, USAC always runs the
+    // maximum number of iterations.
+    double budget_ms = 0;
+    // Full keypoint matching (point_tracker and findH()) every n-th
+    // frame; frame_tracker propagates the homography by optical flow
+    // in between. 0 or 1 means full matching of every frame.
+    unsigned klt_interval = 0;
+};
+
+class MyFlann;
+
+// Keypoint detector, descriptor extractor and descriptor index of one
+// reference image. Instances share no state, so trackers of different
+// cameras run concurrently.
+//
+// match() is thread-safe: the index is only searched after it is built
+// in the constructor. detect() and describe() use the detector and
+// extractor objects of the instance and must not be called from
+// several threads at once.
+class point_tracker {
+public:
+    // gray is the reference image
+    point_tracker(const cv::Mat &gray, const tracking_params &params = {});
+    ~point_tracker();
+    point_tracker(const point_tracker &) = delete;
+    point_tracker &operator=(const point_tracker &) = delete;
+
+    // pre is an image processed by preprocess()
+    std::vector<cv::KeyPoint> detect(const cv::Mat &pre);
+    // Removes keypoints whose descriptors cannot be calculated (too
+    // close to the image border, etc.)
+    cv::Mat describe(const cv::Mat &pre, std::vector<cv::KeyPoint> &kp);
+
+    // Good matches of desc_query (queryIdx) to the reference keypoints
+    // (trainIdx)
+    std::vector<cv::DMatch> match(const cv::Mat &desc_query) const;
+
+    const std::vector<cv::KeyPoint> &reference_keypoints() const { return ref_kp; }
+    const tracking_params &get_params() const { return params; }
+
+private:
+    cv::Ptr<cv::FastFeatureDetector> fast;
+    cv::Ptr<cv::BRISK> brisk;
+
+    const tracking_params params;
+    std::vector<cv::KeyPoint> ref_kp;
+    cv::Mat ref_desc;
+    cv::Ptr<MyFlann> flann;     // matcher_type::flann and lsh
+    cv::Ptr<cv::BFMatcher> bf;  // matcher_type::hamming
+};
+
+// budget_ms is explained in tracking_params. prev is the homography
+// found for the previous frame (if any); it is used only with a time
+// budget.
 cv::Mat findH(const std::vector<cv::KeyPoint> &kp_from,
               const std::vector<cv::KeyPoint> &kp_to,
-              const std::vector<cv::DMatch> &matches);
+              const std::vector<cv::DMatch> &matches,
+              double budget_ms = 0,
+              homography_stats *stats = nullptr,
+              const cv::Mat &prev = cv::Mat());
 cv::Mat preprocess(cv::Mat input);
 
+// Homographies of consecutive frames from the reference image. Full
+// keypoint matching runs every klt_interval frames (see the
+// tracking_params of ref) and whenever optical flow fails or loses
+// too many points. In between, the homography of the previous frame
+// is propagated by pyramidal Lucas-Kanade tracking of strong corners
+// of the previous frame.
+class frame_tracker {
+public:
+    // Detection and matching use ref, which must not be used by other
+    // threads at the same time (except for point_tracker::match())
+    explicit frame_tracker(std::shared_ptr<point_tracker> ref);
+
+    // gray must not be modified later (it is kept for optical flow).
+    // Returns an empty matrix if no homography was found.
+    cv::Mat track(const cv::Mat &gray, homography_stats *stats = nullptr);
+
+private:
+    const std::shared_ptr<point_tracker> ref;
+    cv::Mat H;                  // Of the previous frame
+    unsigned since_full = 0;    // Frames since the last full matching
+
+    // Optical flow state
+    cv::Mat prev_gray;
+    std::vector<cv::Point2f> prev_pts;
+    size_t initial_pts = 0;     // Corners found at the last full matching
+
+    cv::Mat propagate(const cv::Mat &gray, homography_stats &st);
+};
+
 #endif
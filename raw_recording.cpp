@@ -0,0 +1,237 @@
+#include "raw_recording.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using namespace cv;
+using namespace std;
+
+static const char RAW_FILE_MAGIC[8] = { 'T', 'C', 'P', 'C', 'B', 'R', 'A', 'W' };
+static const char RAW_INDEX_MAGIC[8] = { 'T', 'C', 'P', 'C', 'B', 'I', 'D', 'X' };
+static const uint32_t RAW_FRAME_MAGIC = 0x454d5246; // "FRME"
+static const uint32_t RAW_VERSION = 1;
+
+static size_t record_size(uint32_t width, uint32_t height)
+{
+    return sizeof(raw_frame_header) + size_t(width) * height * sizeof(uint16_t);
+}
+
+static runtime_error sys_error(const string &what)
+{
+    return runtime_error(what + ": " + strerror(errno));
+}
+
+raw_writer::raw_writer(const string &path, int width, int height, bool append)
+    : path(path)
+    , width(width)
+    , height(height)
+    , end(sizeof(raw_file_header))
+{
+    struct stat st;
+    if (append && stat(path.c_str(), &st) == 0 && st.st_size > 0) {
+        raw_reader r(path);
+        if (r.width() != width || r.height() != height)
+            throw runtime_error(path + ": cannot append " + to_string(width) + "x" + to_string(height) +
+                                " frames to " + to_string(r.width()) + "x" + to_string(r.height()) + " recording");
+        offsets = r.offsets;
+        if (!offsets.empty())
+            end = offsets.back() + record_size(width, height);
+
+        fd = open(path.c_str(), O_WRONLY);
+        if (fd == -1)
+            throw sys_error(path);
+        // Drop the old index (or incomplete frame), new frames will overwrite it
+        if (ftruncate(fd, end) == -1) {
+            runtime_error e = sys_error(path);
+            ::close(fd);
+            throw e;
+        }
+    } else {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+            throw sys_error(path);
+
+        raw_file_header hdr = {};
+        memcpy(hdr.magic, RAW_FILE_MAGIC, sizeof(hdr.magic));
+        hdr.version = RAW_VERSION;
+        hdr.width = width;
+        hdr.height = height;
+        try {
+            write_all(&hdr, sizeof(hdr), 0);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
+}
+
+raw_writer::~raw_writer()
+{
+    // Frames written so far stay readable without the index (see
+    // raw_reader), so a failure here must not terminate the program.
+    try {
+        close();
+    } catch (const exception &e) {
+        warnx("Closing raw recording: %s", e.what());
+    }
+}
+
+void raw_writer::write_all(const void *buf, size_t size, uint64_t offset)
+{
+    auto p = static_cast<const uint8_t*>(buf);
+    while (size > 0) {
+        ssize_t ret = pwrite(fd, p, size, offset);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            throw sys_error(path);
+        }
+        p += ret;
+        size -= ret;
+        offset += ret;
+    }
+}
+
+void raw_writer::write(const Mat_<uint16_t> &raw, const raw_frame_header &info)
+{
+    if (uint32_t(raw.cols) != width || uint32_t(raw.rows) != height)
+        throw runtime_error(path + ": frame size differs from the recording");
+
+    raw_frame_header hdr = info;
+    hdr.magic = RAW_FRAME_MAGIC;
+    write_all(&hdr, sizeof(hdr), end);
+
+    Mat_<uint16_t> cont = raw.isContinuous() ? raw : raw.clone();
+    write_all(cont.data, cont.total() * cont.elemSize(), end + sizeof(hdr));
+
+    offsets.push_back(end);
+    end += record_size(width, height);
+}
+
+void raw_writer::close()
+{
+    if (fd == -1)
+        return;
+
+    raw_file_footer footer = {};
+    footer.index_offset = end;
+    footer.frame_count = offsets.size();
+    memcpy(footer.magic, RAW_INDEX_MAGIC, sizeof(footer.magic));
+
+    try {
+        write_all(offsets.data(), offsets.size() * sizeof(offsets[0]), end);
+        write_all(&footer, sizeof(footer), end + offsets.size() * sizeof(offsets[0]));
+    } catch (...) {
+        ::close(fd);
+        fd = -1;
+        throw;
+    }
+
+    ::close(fd);
+    fd = -1;
+}
+
+bool raw_reader::is_raw_recording(const string &path)
+{
+    char magic[sizeof(RAW_FILE_MAGIC)];
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    bool ret = read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+        memcmp(magic, RAW_FILE_MAGIC, sizeof(magic)) == 0;
+    ::close(fd);
+    return ret;
+}
+
+raw_reader::raw_reader(const string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw sys_error(path);
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        ::close(fd);
+        throw sys_error(path);
+    }
+    map_size = st.st_size;
+    if (map_size < sizeof(raw_file_header)) {
+        ::close(fd);
+        throw runtime_error(path + ": not a raw recording");
+    }
+
+    // Private writable mapping: accidental writes to the images do
+    // not modify the file.
+    void *m = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED)
+        throw sys_error(path);
+    map = static_cast<uint8_t*>(m);
+    hdr = reinterpret_cast<const raw_file_header*>(map);
+
+    if (memcmp(hdr->magic, RAW_FILE_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != RAW_VERSION) {
+        munmap(map, map_size);
+        throw runtime_error(path + ": not a raw recording (or unsupported version)");
+    }
+
+    // The size of one frame must not overflow below
+    if (size_t(hdr->width) * hdr->height > map_size / sizeof(uint16_t)) {
+        munmap(map, map_size);
+        throw runtime_error(path + ": corrupted header");
+    }
+    const size_t rec_size = record_size(hdr->width, hdr->height);
+    uint64_t frames_end = map_size; // Where the frame data ends
+
+    // Use the index if present and consistent. The footer comes from
+    // the file, so its values are checked before any arithmetic that
+    // could overflow.
+    if (map_size >= sizeof(raw_file_header) + sizeof(raw_file_footer)) {
+        const uint64_t index_end = map_size - sizeof(raw_file_footer);
+        auto footer = reinterpret_cast<const raw_file_footer*>(map + index_end);
+        if (memcmp(footer->magic, RAW_INDEX_MAGIC, sizeof(footer->magic)) == 0 &&
+            footer->index_offset <= index_end &&
+            footer->frame_count <= (index_end - footer->index_offset) / sizeof(uint64_t) &&
+            footer->index_offset + footer->frame_count * sizeof(uint64_t) == index_end) {
+            auto index = reinterpret_cast<const uint64_t*>(map + footer->index_offset);
+            offsets.assign(index, index + footer->frame_count);
+            frames_end = footer->index_offset;
+        }
+    }
+
+    // Otherwise, recover the frames by scanning
+    if (offsets.empty()) {
+        for (uint64_t off = sizeof(raw_file_header); off + rec_size <= frames_end; off += rec_size) {
+            if (reinterpret_cast<const raw_frame_header*>(map + off)->magic != RAW_FRAME_MAGIC)
+                break;
+            offsets.push_back(off);
+        }
+    }
+
+    for (uint64_t off : offsets) {
+        if (off > frames_end || rec_size > frames_end - off) {
+            munmap(map, map_size);
+            throw runtime_error(path + ": corrupted frame index");
+        }
+    }
+}
+
+raw_reader::~raw_reader()
+{
+    munmap(map, map_size);
+}
+
+const raw_frame_header &raw_reader::info(size_t i) const
+{
+    return *reinterpret_cast<const raw_frame_header*>(map + offsets.at(i));
+}
+
+Mat_<uint16_t> raw_reader::image(size_t i) const
+{
+    auto pixels = map + offsets.at(i) + sizeof(raw_frame_header);
+    return Mat_<uint16_t>(hdr->height, hdr->width, reinterpret_cast<uint16_t*>(pixels));
+}
@@ -0,0 +1,104 @@
+#ifndef RAW_RECORDING_HPP
+#define RAW_RECORDING_HPP
+
+#include <opencv2/core/mat.hpp>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Lossless recording of raw calibrated camera frames.
+//
+// File layout (all numbers in native byte order):
+//
+//   raw_file_header
+//   raw_frame_header, uint16_t pixels[height][width]   (frame 0)
+//   raw_frame_header, uint16_t pixels[height][width]   (frame 1)
+//   ...
+//   uint64_t offsets[frame_count]                      (frame index)
+//   raw_file_footer
+//
+// The index is written when the recording is closed. If it is
+// missing (e.g. the recording program was killed), the frames are
+// found by scanning the file, because all frame records have the
+// same size.
+
+struct raw_file_header {
+    char magic[8];              // RAW_FILE_MAGIC
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved[11];
+};
+
+struct raw_frame_header {
+    uint32_t magic;             // RAW_FRAME_MAGIC
+    uint32_t reserved0;
+    uint64_t seq;               // Frame sequence number
+    int64_t time_ns;            // Acquisition time (ns since Unix epoch)
+    float shutter_temp;         // Camera component temperatures [°C],
+    float sensor_temp;          // NaN if unknown
+    float housing_temp;
+    float temp_resolution;      // Temperature [°C] = pixel * temp_resolution + temp_offset
+    float temp_offset;
+    uint32_t reserved[5];
+};
+
+struct raw_file_footer {
+    uint64_t index_offset;
+    uint64_t frame_count;
+    char magic[8];              // RAW_INDEX_MAGIC
+};
+
+static_assert(sizeof(raw_file_header) == 64, "unexpected raw_file_header size");
+static_assert(sizeof(raw_frame_header) == 64, "unexpected raw_frame_header size");
+
+class raw_writer {
+public:
+    // In append mode, new frames are added to an existing recording
+    // (of the same resolution). Otherwise, the file is overwritten.
+    raw_writer(const std::string &path, int width, int height, bool append = false);
+    ~raw_writer();
+
+    void write(const cv::Mat_<uint16_t> &raw, const raw_frame_header &info);
+
+    // Write the index and close the file
+    void close();
+
+private:
+    std::string path;
+    int fd = -1;
+    uint32_t width, height;
+    std::vector<uint64_t> offsets;
+    uint64_t end;               // Offset where the next frame will be written
+
+    void write_all(const void *buf, size_t size, uint64_t offset);
+};
+
+// Read-only access to a recording via mmap. The images returned by
+// image() point directly to the mapped file, so the reader must
+// outlive them.
+class raw_reader {
+public:
+    explicit raw_reader(const std::string &path);
+    ~raw_reader();
+
+    static bool is_raw_recording(const std::string &path);
+
+    size_t size() const { return offsets.size(); }
+    int width() const { return hdr->width; }
+    int height() const { return hdr->height; }
+
+    const raw_frame_header &info(size_t i) const;
+    cv::Mat_<uint16_t> image(size_t i) const;
+
+private:
+    uint8_t *map = nullptr;
+    size_t map_size = 0;
+    const raw_file_header *hdr;
+    std::vector<uint64_t> offsets;
+
+    friend class raw_writer; // To continue a recording in append mode
+};
+
+#endif // RAW_RECORDING_HPP
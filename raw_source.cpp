@@ -0,0 +1,78 @@
+#include "raw_source.hpp"
+#include <opencv2/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+raw_source::raw_source(const string &path)
+    : raw(path)
+{
+    if (raw.size() == 0)
+        throw runtime_error("Raw recording without frames: " + path);
+    update_lut(raw.info(0));
+}
+
+camera_source::capabilities raw_source::get_capabilities() const
+{
+    capabilities c;
+    c.backend = "raw";
+    c.width = raw.width();
+    c.height = raw.height();
+    if (raw.size() > 1) {
+        double duration_s = (raw.info(raw.size() - 1).time_ns - raw.info(0).time_ns) / 1e9;
+        if (duration_s > 0)
+            c.fps = (raw.size() - 1) / duration_s;
+    }
+    c.formats = { pixel_format::raw16 };
+    c.zero_copy = true;
+    c.seekable = true;
+    return c;
+}
+
+bool raw_source::get_image(Mat_<uint16_t> &result, chrono::system_clock::time_point &time)
+{
+    size_t p = pos;
+    if (p >= raw.size()) {
+        if (!loop)
+            return false;
+        p = 0; // loop to start
+    }
+    const raw_frame_header &fi = raw.info(p);
+    update_lut(fi);
+    time = chrono::system_clock::time_point(
+        chrono::duration_cast<chrono::system_clock::duration>(chrono::nanoseconds(fi.time_ns)));
+    result = raw.image(p); // no copy - points to the mapped file
+    pos = p + 1;
+    return true;
+}
+
+uint16_t raw_source::celsius_to_raw(double celsius) const
+{
+    const raw_frame_header &fi = raw.info(0);
+    return saturate_cast<uint16_t>((celsius - fi.temp_offset) / fi.temp_resolution);
+}
+
+vector<pair<string, double>> raw_source::read_component_temps()
+{
+    size_t p = pos;
+    const raw_frame_header &fi = raw.info(p > 0 ? min(p, raw.size()) - 1 : 0);
+    return { { "camera_shutter", fi.shutter_temp },
+             { "camera_sensor",  fi.sensor_temp },
+             { "camera_housing", fi.housing_temp } };
+}
+
+void raw_source::seek(size_t frame)
+{
+    pos = frame;
+}
+
+// The recorded coefficients can change from frame to frame
+void raw_source::update_lut(const raw_frame_header &fi)
+{
+    if (get_lut() && fi.temp_resolution == lut_resolution && fi.temp_offset == lut_offset)
+        return;
+    lut_resolution = fi.temp_resolution;
+    lut_offset = fi.temp_offset;
+    float res = fi.temp_resolution, off = fi.temp_offset;
+    set_lut([=](uint16_t raw) { return raw * res + off; });
+}
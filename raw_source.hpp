@@ -0,0 +1,28 @@
+#ifndef RAW_SOURCE_HPP
+#define RAW_SOURCE_HPP
+
+#include "camera_source.hpp"
+#include "raw_recording.hpp"
+#include <atomic>
+
+// Replay of a lossless raw recording (see raw_recording.hpp). Images
+// point directly to the memory mapped file.
+class raw_source : public camera_source {
+public:
+    explicit raw_source(const std::string &path);
+
+    capabilities get_capabilities() const override;
+    bool get_image(cv::Mat_<uint16_t> &result, std::chrono::system_clock::time_point &time) override;
+    uint16_t celsius_to_raw(double celsius) const override;
+    std::vector<std::pair<std::string, double>> read_component_temps() override;
+    void seek(size_t frame) override;
+
+private:
+    raw_reader raw;
+    std::atomic<size_t> pos{0};
+    float lut_resolution = 0, lut_offset = 0;
+
+    void update_lut(const raw_frame_header &fi);
+};
+
+#endif // RAW_SOURCE_HPP
@@ -0,0 +1,222 @@
+#include "rolling_stats.hpp"
+#include <opencv2/core.hpp>
+#include <cmath>
+
+using namespace cv;
+
+template <typename T>
+rolling_stats<T>::rolling_stats(const rolling_window &w, bool variance)
+    : w(w)
+    , variance(variance)
+    , capacity(w.m == rolling_window::method::exact    ? w.size
+               : w.m == rolling_window::method::blocks ? (w.size + w.block_size() - 1) / w.block_size()
+                                                       : 0)
+{
+    CV_Assert(w.size > 0);
+}
+
+template <typename T>
+void rolling_stats<T>::reset(Size sz)
+{
+    n = head = used = block_n = 0;
+    // Slots are allocated when they are filled for the first time
+    ring.assign(capacity, Mat_<float>());
+    ring_m2.assign(w.m == rolling_window::method::blocks && variance ? capacity : 0, Mat_<float>());
+    sum = Mat_<double>(sz, 0.0);
+    sumsq = variance ? Mat_<double>(sz, 0.0) : Mat_<double>();
+    if (w.m == rolling_window::method::blocks) {
+        block_sum = Mat_<double>(sz, 0.0);
+        block_sumsq = variance ? Mat_<double>(sz, 0.0) : Mat_<double>();
+    }
+}
+
+template <typename T>
+void rolling_stats<T>::update(const Mat_<T> &x)
+{
+    CV_Assert(!x.empty());
+    if (x.size() != sum.size()) {
+        reset(x.size());
+        shift = cv::mean(x)[0];
+    }
+    switch (w.m) {
+    case rolling_window::method::exact:
+        update_exact(x);
+        break;
+    case rolling_window::method::blocks:
+        update_blocks(x);
+        break;
+    case rolling_window::method::exponential:
+        update_exponential(x);
+        break;
+    }
+}
+
+template <typename T>
+void rolling_stats<T>::update_exact(const Mat_<T> &x)
+{
+    const bool full = used == capacity;
+    Mat_<float> &slot = ring[head];
+    if (slot.empty())
+        slot.create(x.size());
+
+    // The removed values are the same floats that were added, so the
+    // sums do not accumulate conversion errors.
+    for (int y = 0; y < x.rows; y++) {
+        const T *s = x[y];
+        float *r = slot[y];
+        double *su = sum[y];
+        double *sq = variance ? sumsq[y] : nullptr;
+        for (int i = 0; i < x.cols; i++) {
+            float v = s[i] - shift;
+            double vn = v, vo = full ? r[i] : 0;
+            r[i] = v;
+            su[i] += vn - vo;
+            if (sq)
+                sq[i] += vn * vn - vo * vo;
+        }
+    }
+
+    head = (head + 1) % capacity;
+    if (!full)
+        used++;
+    n = used;
+}
+
+template <typename T>
+void rolling_stats<T>::update_blocks(const Mat_<T> &x)
+{
+    const size_t B = w.block_size();
+
+    for (int y = 0; y < x.rows; y++) {
+        const T *s = x[y];
+        double *bs = block_sum[y];
+        double *bq = variance ? block_sumsq[y] : nullptr;
+        for (int i = 0; i < x.cols; i++) {
+            double v = s[i] - shift;
+            bs[i] += v;
+            if (bq)
+                bq[i] += v * v;
+        }
+    }
+
+    if (++block_n == B) {
+        // Move the completed block to the ring as its mean and sum of
+        // squared deviations (which keeps precision in float)
+        const bool full = used == capacity;
+        Mat_<float> &mean = ring[head];
+        if (mean.empty())
+            mean.create(x.size());
+        if (variance && ring_m2[head].empty())
+            ring_m2[head].create(x.size());
+
+        for (int y = 0; y < x.rows; y++) {
+            float *r = mean[y];
+            float *r2 = variance ? ring_m2[head][y] : nullptr;
+            double *su = sum[y], *bs = block_sum[y];
+            double *sq = variance ? sumsq[y] : nullptr, *bq = variance ? block_sumsq[y] : nullptr;
+            for (int i = 0; i < x.cols; i++) {
+                float m = bs[i] / B;
+                su[i] += B * (double(m) - (full ? r[i] : 0));
+                if (sq) {
+                    float m2 = std::max(bq[i] - bs[i] * bs[i] / B, 0.0);
+                    double qn = B * double(m) * m + m2;
+                    double qo = full ? B * double(r[i]) * r[i] + r2[i] : 0;
+                    sq[i] += qn - qo;
+                    r2[i] = m2;
+                    bq[i] = 0;
+                }
+                r[i] = m;
+                bs[i] = 0;
+            }
+        }
+
+        head = (head + 1) % capacity;
+        if (!full)
+            used++;
+        block_n = 0;
+    }
+    n = used * B + block_n;
+}
+
+template <typename T>
+void rolling_stats<T>::update_exponential(const Mat_<T> &x)
+{
+    // Same mean age of the values as with the rectangular window
+    const double a = double(w.size - 1) / (w.size + 1);
+
+    for (int y = 0; y < x.rows; y++) {
+        const T *s = x[y];
+        double *m = sum[y];
+        double *q = variance ? sumsq[y] : nullptr;
+        for (int i = 0; i < x.cols; i++) {
+            double v = s[i] - shift;
+            if (n == 0) {
+                m[i] = v;
+                continue;
+            }
+            double d = v - m[i];
+            m[i] += (1 - a) * d;
+            if (q)
+                q[i] = a * (q[i] + (1 - a) * d * d);
+        }
+    }
+    n = std::min(n + 1, w.size);
+}
+
+template <typename T>
+void rolling_stats<T>::mean(Mat_<T> &out) const
+{
+    out.create(sum.size());
+    for (int y = 0; y < out.rows; y++) {
+        const double *su = sum[y];
+        const double *bs = block_sum.empty() ? nullptr : block_sum[y];
+        T *d = out[y];
+        for (int i = 0; i < out.cols; i++) {
+            if (w.m == rolling_window::method::exponential)
+                d[i] = su[i] + shift;
+            else
+                d[i] = n ? (su[i] + (bs ? bs[i] : 0)) / n + shift : 0;
+        }
+    }
+}
+
+template <typename T>
+void rolling_stats<T>::stddev(Mat_<T> &out) const
+{
+    CV_Assert(variance);
+    out.create(sum.size());
+    for (int y = 0; y < out.rows; y++) {
+        const double *su = sum[y], *sq = sumsq[y];
+        const double *bs = block_sum.empty() ? nullptr : block_sum[y];
+        const double *bq = block_sumsq.empty() ? nullptr : block_sumsq[y];
+        T *d = out[y];
+        for (int i = 0; i < out.cols; i++) {
+            double var;
+            if (w.m == rolling_window::method::exponential) {
+                var = sq[i];
+            } else if (n < 2) {
+                var = 0;
+            } else {
+                double s = su[i] + (bs ? bs[i] : 0);
+                double q = sq[i] + (bq ? bq[i] : 0);
+                var = (q - s * s / n) / (n - 1);
+            }
+            d[i] = std::sqrt(std::max(var, 0.0));
+        }
+    }
+}
+
+template <typename T>
+size_t rolling_stats<T>::memory() const
+{
+    auto bytes = [](const Mat &m) { return m.total() * m.elemSize(); };
+    size_t b = bytes(sum) + bytes(sumsq) + bytes(block_sum) + bytes(block_sumsq);
+    for (const auto &m : ring)
+        b += bytes(m);
+    for (const auto &m : ring_m2)
+        b += bytes(m);
+    return b;
+}
+
+template class rolling_stats<float>;
+template class rolling_stats<double>;
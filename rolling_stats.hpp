@@ -0,0 +1,80 @@
+#ifndef ROLLING_STATS_HPP
+#define ROLLING_STATS_HPP
+
+#include <opencv2/core/mat.hpp>
+#include <algorithm>
+#include <vector>
+
+// Length of a rolling window and how it is stored
+struct rolling_window {
+    enum class method {
+        exact,          // Ring buffer of all images in the window (as float)
+        blocks,         // Ring buffer of averages of `block` consecutive images
+        exponential,    // Exponentially weighted statistics with the same mean age (no buffer)
+    };
+    size_t size = 100;  // Number of images
+    method m = method::exact;
+    size_t block = 0;   // Images per block (method::blocks); 0 means size/64
+
+    size_t block_size() const { return block ? block : std::max<size_t>(1, (size + 63) / 64); }
+};
+
+// Per-pixel mean and standard deviation of the last images of a
+// sequence. Every update() takes O(pixels) time independently of the
+// window size: running sums (in double) are incremented by the new
+// image and decremented by the one leaving the window. The values are
+// shifted by the mean of the first image to avoid cancellation in the
+// sums of squares.
+//
+// With method::blocks, the buffer holds ceil(size / block) complete
+// blocks and is block-times smaller. Together with the incomplete
+// block, the statistics cover between ceil(size / block) * block and
+// ceil(size / block) * block + block - 1 images (at most
+// size + 2 * block - 2).
+// method::exponential needs no buffer at all and approximates the
+// window by exponential weights with α = (size - 1) / (size + 1).
+template <typename T>
+class rolling_stats {
+public:
+    explicit rolling_stats(const rolling_window &w, bool variance = true);
+
+    void update(const cv::Mat_<T> &x);
+
+    // Number of images in the window
+    size_t count() const { return n; }
+
+    void mean(cv::Mat_<T> &out) const;
+
+    // Sample standard deviation (zero for less than two images)
+    void stddev(cv::Mat_<T> &out) const;
+
+    // Memory used by the buffer and the sums [bytes]
+    size_t memory() const;
+
+private:
+    const rolling_window w;
+    const bool variance;        // Whether to calculate stddev()
+    const size_t capacity;      // Number of ring slots
+
+    double shift = 0;
+    size_t n = 0;
+
+    // Images or block means (method::exact, method::blocks) and the
+    // sums of squared deviations from the block means
+    std::vector<cv::Mat_<float>> ring, ring_m2;
+    size_t head = 0, used = 0;
+
+    // Sums over the ring, or exponentially weighted mean and variance
+    cv::Mat_<double> sum, sumsq;
+
+    // Incomplete block (method::blocks)
+    cv::Mat_<double> block_sum, block_sumsq;
+    size_t block_n = 0;
+
+    void reset(cv::Size sz);
+    void update_exact(const cv::Mat_<T> &x);
+    void update_blocks(const cv::Mat_<T> &x);
+    void update_exponential(const cv::Mat_<T> &x);
+};
+
+#endif // ROLLING_STATS_HPP
@@ -1,14 +1,40 @@
-var counter = 0;
-
 function toggleUpdate(img) {
     img.parentElement.getElementsByTagName('input')[0].checked ^= 1;
 }
 
+// Reload the image unless it is still loading. The server answers
+// 304 Not Modified if the image did not change since the last load.
+function reloadImage(imgel, url) {
+    if (imgel.dataset.loading)
+	return;
+    imgel.dataset.loading = 1;
+    fetch(url, { cache: 'no-cache' })
+	.then((res) => {
+	    let etag = res.headers.get('ETag');
+	    if (!res.ok || (etag && etag === imgel.dataset.etag))
+		return;
+	    imgel.dataset.etag = etag;
+	    return res.blob().then((blob) => {
+		if (imgel.src.startsWith('blob:'))
+		    URL.revokeObjectURL(imgel.src);
+		imgel.src = URL.createObjectURL(blob);
+	    });
+	})
+	.catch(() => {})
+	.finally(() => { delete imgel.dataset.loading; });
+}
+
+// With index.html?stream, the camera image is drawn from the binary
+// stream (see below), with ?mjpeg it is an MJPEG stream. Otherwise
+// thermocam-current.jpg is reloaded after each update.
+var pageParams = new URLSearchParams(location.search);
+var useStream = pageParams.has('stream');
+var useMjpeg = pageParams.has('mjpeg');
+
 function reloadAllImages(imgs) {
-    counter++;
     imgel = document.getElementById('camera');
-    if (imgel.complete)
-	imgel.src='thermocam-current.jpg?c=' + counter;
+    if (!useStream && !useMjpeg)
+	reloadImage(imgel, 'thermocam-current.jpg');
     let x = 1;
     webimgs = document.getElementById('webimgs');
     imgs.forEach((img_list) => {
@@ -25,8 +51,7 @@ function reloadAllImages(imgs) {
             }
 	    imgel = div.getElementsByTagName('img')[0];
 	    if (div.getElementsByTagName('input')[0].checked) {
-		if (imgel.complete)
-		    imgel.src = `${img.name}.jpg?c=${counter}`;
+		reloadImage(imgel, `${img.name}.jpg`);
 		imgel.style.filter = "";
 	    } else {
 		imgel.style.filter = "grayscale(100%)";
@@ -43,8 +68,11 @@ if (window.location.protocol === 'https:') {
     wsProtocol = 'wss://';
 }
 
+// Relative to the page to support multiple cameras (/camN/ws)
+var path = location.pathname.replace(/[^/]*$/, '');
+
 function reconnect() {
-    var socket = new WebSocket(wsProtocol + location.host + "/ws");
+    var socket = new WebSocket(wsProtocol + location.host + path + "ws");
 
     socket.onopen = ()=>{
         console.log('open');
@@ -58,6 +86,157 @@ function reconnect() {
     socket.onmessage = (event) => {
         let msg = JSON.parse(event.data);
         reloadAllImages(msg.imgs);
+        // Flow control: the server sends only a few unacknowledged updates
+        socket.send('ack');
     }
 }
 reconnect();
+
+// Binary stream of temperatures (/stream, format described in README)
+
+// Value of every float16 bit pattern
+const halfToFloat = (() => {
+    let lut = new Float32Array(65536);
+    for (let h = 0; h < 65536; h++) {
+	let sign = h & 0x8000 ? -1 : 1, e = (h >> 10) & 0x1f, f = h & 0x3ff;
+	lut[h] = sign * (e === 0 ? f * 2 ** -24
+			 : e === 31 ? (f ? NaN : Infinity)
+			 : (1 + f / 1024) * 2 ** (e - 15));
+    }
+    return lut;
+})();
+
+// Inferno-like colormap: 256 RGB triplets interpolated from a few stops
+const colormap = (() => {
+    const stops = [[0, 0, 4], [31, 12, 72], [85, 15, 109], [136, 34, 106], [186, 54, 85],
+		   [227, 89, 51], [249, 140, 10], [249, 201, 50], [252, 255, 164]];
+    let lut = new Uint8Array(256 * 3);
+    for (let i = 0; i < 256; i++) {
+	let t = i / 255 * (stops.length - 1), k = Math.min(Math.floor(t), stops.length - 2), f = t - k;
+	for (let c = 0; c < 3; c++)
+	    lut[3 * i + c] = Math.round(stops[k][c] * (1 - f) + stops[k + 1][c] * f);
+    }
+    return lut;
+})();
+
+async function decodeFrame(buf, prev) {
+    let dv = new DataView(buf);
+    if (String.fromCharCode(...new Uint8Array(buf, 0, 4)) !== 'TCF1')
+	throw new Error('Unknown frame format');
+    let hdrSize = dv.getUint32(4, true);
+    let f = {
+	frame: Number(dv.getBigUint64(8, true)),
+	time: new Date(Number(dv.getBigInt64(16, true)) / 1000),
+	width: dv.getUint16(24, true),
+	height: dv.getUint16(26, true),
+	border: [], poi: [], hs: [],
+    };
+    let flags = dv.getUint8(28), nBorder = dv.getUint8(29), nPoi = dv.getUint16(30, true), nHs = dv.getUint16(32, true);
+    let payloadSize = dv.getUint32(36, true);
+    let off = 40;
+    let float = () => { off += 4; return dv.getFloat32(off - 4, true); };
+    for (let i = 0; i < nBorder; i++)
+	f.border.push([float(), float()]);
+    for (let i = 0; i < nPoi; i++) {
+	let x = float(), y = float(), temp = float(), len = dv.getUint8(off++);
+	let name = new TextDecoder().decode(new Uint8Array(buf, off, len));
+	off += len;
+	f.poi.push({ name, x, y, temp });
+    }
+    for (let i = 0; i < nHs; i++)
+	f.hs.push([float(), float(), float()]);
+
+    let payload = buf.slice(hdrSize, hdrSize + payloadSize);
+    if (flags & 2)
+	payload = await new Response(new Blob([payload]).stream()
+				     .pipeThrough(new DecompressionStream('deflate'))).arrayBuffer();
+    f.half = new Uint16Array(payload);
+    if (flags & 1) {
+	if (!prev || prev.length !== f.half.length)
+	    throw new Error('Delta frame without a previous frame');
+	for (let i = 0; i < f.half.length; i++)
+	    f.half[i] += prev[i];  // Modulo 2^16
+    }
+    return f;
+}
+
+function drawFrame(canvas, f) {
+    let n = f.width * f.height;
+    let celsius = new Float32Array(n);
+    let min = Infinity, max = -Infinity;
+    for (let i = 0; i < n; i++) {
+	let t = celsius[i] = halfToFloat[f.half[i]];
+	if (t < min) min = t;
+	if (t > max) max = t;
+    }
+    if (canvas.width !== f.width || canvas.height !== f.height) {
+	canvas.width = f.width;
+	canvas.height = f.height;
+	canvas.style.width = `${2 * f.width}px`;
+    }
+    let ctx = canvas.getContext('2d');
+    let img = ctx.createImageData(f.width, f.height);
+    let scale = max > min ? 255 / (max - min) : 0;
+    for (let i = 0; i < n; i++) {
+	let c = 3 * Math.round((celsius[i] - min) * scale);
+	img.data[4 * i] = colormap[c];
+	img.data[4 * i + 1] = colormap[c + 1];
+	img.data[4 * i + 2] = colormap[c + 2];
+	img.data[4 * i + 3] = 255;
+    }
+    ctx.putImageData(img, 0, 0);
+
+    ctx.strokeStyle = ctx.fillStyle = 'white';
+    ctx.font = '8px sans-serif';
+    if (f.border.length) {
+	ctx.beginPath();
+	f.border.forEach(([x, y]) => ctx.lineTo(x, y));
+	ctx.closePath();
+	ctx.stroke();
+    }
+    f.poi.forEach((p) => {
+	ctx.fillRect(p.x - 1, p.y - 1, 2, 2);
+	ctx.fillText(`${p.name} ${p.temp.toFixed(1)}`, p.x + 2, p.y - 2);
+    });
+    return celsius;
+}
+
+function startStream() {
+    let canvas = document.getElementById('stream');
+    let cursor = document.getElementById('cursor');
+    let prev = null, celsius = null, queue = Promise.resolve();
+    document.getElementById('camera').hidden = true;
+    canvas.hidden = false;
+
+    let socket = new WebSocket(wsProtocol + location.host + path + "stream");
+    socket.binaryType = 'arraybuffer';
+    socket.onopen = () => socket.send('options zlib delta');
+    socket.onclose = () => setTimeout(startStream, 3000);
+    socket.onmessage = (event) => {
+	// Decompression is asynchronous, but delta frames must be
+	// decoded in order
+	queue = queue.then(() => decodeFrame(event.data, prev))
+	    .then((f) => {
+		prev = f.half;
+		celsius = drawFrame(canvas, f);
+		socket.send('ack');
+	    })
+	    .catch(() => socket.close());
+    };
+    canvas.onmousemove = (e) => {
+	if (!celsius)
+	    return;
+	let r = canvas.getBoundingClientRect();
+	let x = Math.floor((e.clientX - r.left) * canvas.width / r.width);
+	let y = Math.floor((e.clientY - r.top) * canvas.height / r.height);
+	if (x >= 0 && x < canvas.width && y >= 0 && y < canvas.height)
+	    cursor.textContent = `[${x}, ${y}] ${celsius[y * canvas.width + x].toFixed(2)} °C`;
+    };
+}
+if (useStream)
+    startStream();
+
+// The server redirects to the MJPEG port over plain HTTP, so this
+// does not work in pages loaded over HTTPS (mixed content)
+if (useMjpeg && !useStream)
+    document.getElementById('camera').src = 'thermocam-current.mjpg';
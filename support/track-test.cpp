@@ -944,7 +944,7 @@ std::pair<vector<cv::Point2f>,vector<cv::Point2f>> selectGoodMatches(vector<KeyP
 {
     vector<cv::DMatch> good_matches;
     for (auto match : matches)
-        if (match[0].distance < thresh * match[1].distance)
+        if (match.size() >= 2 && match[0].distance < thresh * match[1].distance)
             good_matches.push_back(match[0]);
 
     vector<cv::Point2f> toP(good_matches.size()), fromP(good_matches.size());
@@ -1622,6 +1622,98 @@ vector<cv::ScoreMethod> scoremethods {
     cv::ScoreMethod::SCORE_METHOD_MAGSAC,
 };
 
+// Descriptor matching methods compared by benchmarkMatchers(), the
+// same as matcher_type in point-tracking.hpp
+enum class MatcherType { FLANN, HAMMING, LSH };
+
+// Like matchDescs(), but with the given method, in a single thread and
+// with each reference trained only once. time_us is set to the average
+// matching time per generated image (including the conversion of
+// descriptors to float for FLANN).
+vector<vector<vector<cv::DMatch>>> matchDescsWith(MatcherType type, unsigned n_ref, unsigned n_gen, vector<Mat> d, double &time_us)
+{
+    vector<vector<vector<cv::DMatch>>> matches(n_ref*n_gen);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (unsigned r = 0; r < n_ref; r++) {
+        unsigned ref = r * (n_gen + 1);
+        if (d[ref].rows <= 2)
+            continue;
+        cv::Ptr<cv::DescriptorMatcher> m;
+        switch (type) {
+        case MatcherType::FLANN:
+            m = cv::makePtr<cv::FlannBasedMatcher>();
+            break;
+        case MatcherType::HAMMING:
+            m = cv::BFMatcher::create(cv::NORM_HAMMING);
+            break;
+        case MatcherType::LSH:
+            m = cv::makePtr<cv::FlannBasedMatcher>(cv::makePtr<cv::flann::LshIndexParams>(12, 20, 2));
+            break;
+        }
+        Mat train = d[ref];
+        if (type == MatcherType::FLANN)
+            train.convertTo(train, CV_32F);
+        m->add(train);
+        m->train();
+        for (unsigned g = 1; g <= n_gen; g++) {
+            Mat query = d[ref + g];
+            if (query.rows <= 2)
+                continue;
+            if (type == MatcherType::FLANN)
+                query.convertTo(query, CV_32F);
+            m->knnMatch(query, matches[r * n_gen + g - 1], 2);
+        }
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    time_us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / double(n_ref * n_gen);
+    return matches;
+}
+
+// Compare speed and accuracy of descriptor matching methods. The
+// homographies are calculated with the same parameters as in
+// point-tracking.cpp.
+void benchmarkMatchers(vector<Mat> I, vector<Mat> H_ref, unsigned n_refs, vector<Mat> masks = {})
+{
+    init(I[0].cols,I[0].rows);
+    unsigned n_gen = (I.size() - n_refs) / n_refs;
+    auto kpdesc = calcKpDesc(I,n_refs,masks);
+    vector<vector<KeyPoint>> &kp = kpdesc.first;
+
+    cv::UsacParams usacparams;
+    usacparams.threshold = 6;
+    usacparams.sampler = cv::SamplingMethod::SAMPLING_UNIFORM;
+    usacparams.loSampleSize = 12;
+    usacparams.loMethod = cv::LocalOptimMethod::LOCAL_OPTIM_INNER_AND_ITER_LO;
+    usacparams.score = cv::ScoreMethod::SCORE_METHOD_MSAC;
+    usacparams.confidence = 0.9999999999999999999;
+    usacparams.maxIterations = 90000;
+
+    const std::pair<MatcherType, const char *> methods[] = {
+        { MatcherType::FLANN, "flann" },
+        { MatcherType::HAMMING, "hamming" },
+        { MatcherType::LSH, "lsh" },
+    };
+    cout << "matcher\tmatch [us/img]\tgood matches/img\tmean error [px]\tno homography" << endl;
+    for (auto [type, name] : methods) {
+        double time_us;
+        auto matches = matchDescsWith(type, n_refs, n_gen, kpdesc.second, time_us);
+        vector<Mat> H(n_refs*n_gen);
+        size_t good = 0;
+        unsigned failed = 0;
+        for (unsigned i = 0; i < H.size(); i++) {
+            auto gm = selectGoodMatches(kp[i / n_gen * (n_gen + 1)],
+                                        kp[i / n_gen * (n_gen + 1) + i % n_gen + 1], matches[i], 0.88);
+            good += gm.first.size();
+            if (gm.first.size() >= 4)
+                H[i] = cv::findHomography(gm.first, gm.second, cv::noArray(), usacparams);
+            if (H[i].empty())
+                failed++;
+        }
+        cout << name << "\t" << time_us << "\t" << double(good) / H.size() << "\t"
+             << vsum(meanTransformError(H, H_ref, test_points)) / H.size() << "\t" << failed << endl;
+    }
+}
+
 vector<vector<double>> runTest(vector<Mat> I, vector<Mat> H_ref, unsigned n_refs, vector<Mat> masks = {})
 {
     init(I[0].cols,I[0].rows);
@@ -1667,7 +1759,7 @@ int main()
 {
     //srand (time(NULL));
     srand (0);
-    bool train = true, test = false;
+    bool train = true, test = false, bench_matchers = false;
     bool toy = false;
 
     cv::String testname = "usac_bestparam";
@@ -1692,6 +1784,8 @@ int main()
         train_H = removeRefHomographies(train_H,n_refs);
 
         train_I = preprocess(train_I);
+        if (bench_matchers)
+            benchmarkMatchers(train_I,train_H,n_refs,masks);
         vector<vector<double>> score = runTest(train_I,train_H,n_refs,masks);
         cv::String filename = "train_" + testname + ".csv";
         //writeCSV(filename,score);
@@ -0,0 +1,238 @@
+#include "synthetic_camera.hpp"
+#include "frame_pool.hpp"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+using namespace cv;
+using namespace std;
+
+static constexpr float ambient_temp = 22;
+static constexpr float board_temp = 28;
+static constexpr float noise_std = 0.05; // Sensor noise [°C]
+
+synthetic_camera::params synthetic_camera::params::parse(const string &spec)
+{
+    params p;
+    stringstream ss(spec);
+    string item;
+
+    while (getline(ss, item, ',')) {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        string key = item.substr(0, eq);
+        string val = eq == string::npos ? "" : item.substr(eq + 1);
+        try {
+            if (key == "size") {
+                size_t x = val.find('x');
+                if (x == string::npos)
+                    throw invalid_argument(val);
+                p.width = stoi(val.substr(0, x));
+                p.height = stoi(val.substr(x + 1));
+            } else if (key == "fps") {
+                p.fps = stod(val);
+            } else if (key == "frames") {
+                p.frames = stoul(val);
+            } else if (key == "hotspots") {
+                p.hotspots = stoul(val);
+            } else if (key == "switch") {
+                p.switch_period = stod(val);
+            } else if (key == "drift") {
+                p.drift = stod(val);
+            } else if (key == "seed") {
+                p.seed = stoul(val);
+            } else if (key == "truth") {
+                p.truth_path = val;
+            } else {
+                throw runtime_error("Unknown synthetic camera option: " + key);
+            }
+        } catch (const logic_error &) { // invalid_argument, out_of_range
+            throw runtime_error("Invalid value of synthetic camera option " + key + ": " + val);
+        }
+    }
+    if (p.width < 64 || p.height < 64)
+        throw runtime_error("Synthetic camera resolution must be at least 64x64");
+    if (p.fps <= 0)
+        throw runtime_error("Synthetic camera fps must be positive");
+    if (p.switch_period <= 0)
+        throw runtime_error("Synthetic camera switch period must be positive");
+    return p;
+}
+
+synthetic_camera::synthetic_camera(const params &p)
+    : p(p)
+{
+    generate_board();
+
+    RNG rng(p.seed + 1);
+    float scale = min(p.width, p.height);
+    for (unsigned i = 0; i < p.hotspots; i++) {
+        hotspot h;
+        h.switching = i % 2;
+        h.sigma = rng.uniform(0.01f, 0.03f) * scale;
+        h.temp = rng.uniform(10.0f, 40.0f);
+        h.phase = rng.uniform(0.0f, float(2 * M_PI));
+        h.freq = rng.uniform(0.02f, 0.1f);
+        h.pos[0] = Point2f(rng.uniform(0.25f, 0.75f) * p.width,
+                           rng.uniform(0.25f, 0.75f) * p.height);
+        if (h.switching)
+            h.pos[1] = Point2f(rng.uniform(0.2f, 0.8f) * p.width,
+                               rng.uniform(0.2f, 0.8f) * p.height);
+        else
+            h.pos[1] = Point2f(rng.uniform(0.05f, 0.15f) * p.width,
+                               rng.uniform(0.05f, 0.15f) * p.height);
+        hs.push_back(h);
+    }
+
+    if (!p.truth_path.empty()) {
+        truth.open(p.truth_path);
+        if (!truth)
+            throw runtime_error("Cannot open " + p.truth_path);
+        truth << "Frame, Time [s], h11, h12, h13, h21, h22, h23, h31, h32, h33\n";
+    }
+}
+
+void synthetic_camera::generate_board()
+{
+    int w = p.width, h = p.height;
+    RNG rng(p.seed);
+
+    board.create(h, w);
+    board = ambient_temp;
+
+    Rect pcb(w * 0.08, h * 0.08, w * 0.84, h * 0.84);
+    board(pcb) = board_temp;
+
+    // Copper traces routed in horizontal and vertical segments
+    unsigned traces = w * h / 4000;
+    for (unsigned i = 0; i < traces; i++) {
+        Point a(rng.uniform(pcb.x, pcb.x + pcb.width), rng.uniform(pcb.y, pcb.y + pcb.height));
+        Point b = rng.uniform(0, 2)
+            ? Point(rng.uniform(pcb.x, pcb.x + pcb.width), a.y)
+            : Point(a.x, rng.uniform(pcb.y, pcb.y + pcb.height));
+        line(board, a, b, board_temp + rng.uniform(0.5, 2.0), rng.uniform(1, 3));
+    }
+
+    // Small components (resistors, capacitors) with warmer pads
+    unsigned components = w * h / 8000;
+    for (unsigned i = 0; i < components; i++) {
+        Size sz(rng.uniform(4, 20), rng.uniform(4, 20));
+        Point tl(rng.uniform(pcb.x, pcb.x + pcb.width - sz.width),
+                 rng.uniform(pcb.y, pcb.y + pcb.height - sz.height));
+        float t = rng.uniform(30.0f, 45.0f);
+        if (rng.uniform(0, 4) == 0) {
+            circle(board, tl + Point(sz.width / 2, sz.width / 2), sz.width / 2, t, FILLED);
+        } else {
+            rectangle(board, Rect(tl, sz), t, FILLED);
+            rectangle(board, Rect(tl, sz), t + 2, 1);
+        }
+    }
+
+    // Chips: large packages with pins
+    for (int i = 0; i < 5; i++) {
+        Size sz(min<int>(rng.uniform(0.08, 0.15) * w, pcb.width),
+                min<int>(rng.uniform(0.08, 0.15) * h, pcb.height));
+        Point tl(rng.uniform(pcb.x, pcb.x + pcb.width - sz.width),
+                 rng.uniform(pcb.y, pcb.y + pcb.height - sz.height));
+        float t = rng.uniform(38.0f, 50.0f);
+        Rect r(tl, sz);
+        for (int x = r.x; x < r.x + r.width; x += 4) {
+            line(board, Point(x, r.y - 3), Point(x, r.y + r.height + 3), t - 4, 1);
+        }
+        rectangle(board, r, t, FILLED);
+        circle(board, tl + Point(5, 5), 2, t - 3, FILLED); // Pin 1 mark
+    }
+
+    // Optics of the camera
+    GaussianBlur(board, board, Size(), 1.0);
+}
+
+void synthetic_camera::add_hotspot(const hotspot &h, double t)
+{
+    Point2f c;
+    if (h.switching) {
+        c = h.pos[int(floor(t / p.switch_period)) % 2];
+    } else {
+        double a = 2 * M_PI * h.freq * t + h.phase;
+        c = h.pos[0] + Point2f(h.pos[1].x * sin(a), h.pos[1].y * sin(1.3 * a));
+    }
+
+    int r = ceil(3 * h.sigma);
+    Rect roi = Rect(Point(c) - Point(r, r), Size(2 * r + 1, 2 * r + 1)) & Rect(0, 0, field.cols, field.rows);
+    float k = -0.5f / (h.sigma * h.sigma);
+    for (int y = roi.y; y < roi.y + roi.height; y++) {
+        float *row = field[y];
+        float dy2 = (y - c.y) * (y - c.y);
+        for (int x = roi.x; x < roi.x + roi.width; x++) {
+            float dx = x - c.x;
+            row[x] += h.temp * exp(k * (dx * dx + dy2));
+        }
+    }
+}
+
+chrono::nanoseconds synthetic_camera::frame_time(size_t frame) const
+{
+    return chrono::nanoseconds(int64_t(frame * 1e9 / p.fps));
+}
+
+Matx33d synthetic_camera::homography(size_t frame) const
+{
+    if (p.drift == 0)
+        return Matx33d::eye();
+
+    // Slow rotation, scaling and translation around the image center
+    double t = frame / p.fps;
+    double w = p.width, h = p.height;
+    double angle = p.drift / w * sin(2 * M_PI * t / 60);
+    double scale = 1 + 0.5 * p.drift / w * sin(2 * M_PI * t / 45);
+    double tx = p.drift * sin(2 * M_PI * t / 40);
+    double ty = p.drift * sin(2 * M_PI * t / 50 + 1);
+
+    Matx33d C(1, 0, w / 2, 0, 1, h / 2, 0, 0, 1);
+    Matx33d iC(1, 0, -w / 2, 0, 1, -h / 2, 0, 0, 1);
+    Matx33d A(scale * cos(angle), -scale * sin(angle), tx,
+              scale * sin(angle),  scale * cos(angle), ty,
+              0, 0, 1);
+    return C * A * iC;
+}
+
+vector<pair<string, double>> synthetic_camera::component_temps(size_t frame) const
+{
+    double t = frame / p.fps;
+    double drift = 0.5 * sin(2 * M_PI * t / 600); // Slow warm up/cool down cycle
+    return { { "camera_shutter", 30 + drift },
+             { "camera_sensor",  34 + drift },
+             { "camera_housing", 31 + drift } };
+}
+
+void synthetic_camera::get_image(size_t frame, Mat_<uint16_t> &result)
+{
+    double t = frame / p.fps;
+
+    board.copyTo(field);
+    for (const hotspot &h : hs)
+        add_hotspot(h, t);
+
+    Matx33d H = homography(frame);
+    warpPerspective(field, warped, H, field.size(), INTER_LINEAR, BORDER_CONSTANT, ambient_temp);
+
+    // Noise is random, but reproducible for every frame
+    noise.create(warped.size());
+    RNG rng(p.seed * 1000003ULL + frame);
+    rng.fill(noise, RNG::NORMAL, Scalar(0), Scalar(noise_std));
+    warped += noise;
+
+    frame_pool::instance().create(result, warped.rows, warped.cols);
+    warped.convertTo(result, CV_16U, 1.0 / temp_resolution, -temp_offset / temp_resolution);
+
+    if (truth.is_open()) {
+        truth << frame << ", " << fixed << setprecision(3) << t << setprecision(9);
+        for (int i = 0; i < 9; i++)
+            truth << ", " << H.val[i];
+        truth << "\n";
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef SYNTHETIC_CAMERA_HPP
+#define SYNTHETIC_CAMERA_HPP
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/core/matx.hpp>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Procedurally generated thermal images of a PCB-like board. Allows
+// benchmarking and testing without a camera or recorded files.
+//
+// The board (traces, components and chips) is generated once from
+// the seed. Hot spots are added to every frame: some of them move
+// along smooth paths, others periodically switch between two places
+// (like a workload migrating between CPUs). The whole board then
+// slowly drifts in the image by a known homography, which can be
+// written to a CSV file to evaluate point tracking.
+//
+// Everything depends only on the seed and the frame number, so the
+// same options always produce the same images.
+class synthetic_camera {
+public:
+    struct params {
+        int width = 640;
+        int height = 512;
+        double fps = 9;
+        size_t frames = 0;          // Number of frames in one loop (0 = unlimited)
+        unsigned hotspots = 4;
+        double switch_period = 1;   // Period of switching hot spots [s]
+        double drift = 10;          // Maximum board translation [px]
+        unsigned seed = 1;
+        std::string truth_path;     // CSV file for ground truth homographies
+
+        // Parse comma separated list of key=value pairs, e.g.
+        // "size=1280x1024,fps=30,frames=1000". Throws
+        // std::runtime_error on invalid input.
+        static params parse(const std::string &spec);
+    };
+
+    // Raw pixel value = (°C - temp_offset) / temp_resolution
+    static constexpr float temp_resolution = 0.01;
+    static constexpr float temp_offset = -100;
+
+    explicit synthetic_camera(const params &p);
+
+    const params &get_params() const { return p; }
+
+    // Render the given frame
+    void get_image(size_t frame, cv::Mat_<uint16_t> &result);
+
+    // Time of the frame relative to the first frame
+    std::chrono::nanoseconds frame_time(size_t frame) const;
+
+    // Ground truth homography transforming board (i.e. frame 0)
+    // coordinates to the coordinates in the given frame
+    cv::Matx33d homography(size_t frame) const;
+
+    std::vector<std::pair<std::string, double>> component_temps(size_t frame) const;
+
+private:
+    struct hotspot {
+        cv::Point2f pos[2];     // Moving: path center and amplitude; switching: the two places
+        float phase;
+        float freq;
+        float sigma;
+        float temp;             // Temperature increase in the center [°C]
+        bool switching;
+    };
+
+    params p;
+    cv::Mat_<float> board;      // Static board temperature [°C]
+    std::vector<hotspot> hs;
+    cv::Mat_<float> field, warped, noise; // Per-frame buffers
+    std::ofstream truth;
+
+    void generate_board();
+    void add_hotspot(const hotspot &h, double t);
+};
+
+#endif // SYNTHETIC_CAMERA_HPP
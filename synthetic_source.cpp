@@ -0,0 +1,68 @@
+#include "synthetic_source.hpp"
+#include <opencv2/core.hpp>
+#include <thread>
+
+using namespace cv;
+using namespace std;
+
+synthetic_source::synthetic_source(const synthetic_camera::params &p)
+    : cam(p)
+{
+    set_lut([](uint16_t raw) {
+        return raw * synthetic_camera::temp_resolution + synthetic_camera::temp_offset;
+    });
+}
+
+camera_source::capabilities synthetic_source::get_capabilities() const
+{
+    const synthetic_camera::params &p = cam.get_params();
+    capabilities c;
+    c.backend = "synthetic";
+    c.width = p.width;
+    c.height = p.height;
+    c.fps = p.fps;
+    c.formats = { pixel_format::raw16 };
+    c.live = realtime;
+    c.seekable = true;
+    return c;
+}
+
+bool synthetic_source::get_image(Mat_<uint16_t> &result, chrono::system_clock::time_point &time)
+{
+    size_t frames = cam.get_params().frames;
+    size_t p = pos;
+    if (frames && p >= frames) {
+        if (!loop)
+            return false;
+        p = 0;
+        start = {}; // Restart frame rate timing
+    }
+    if (start == chrono::steady_clock::time_point()) {
+        start = chrono::steady_clock::now() - cam.frame_time(p);
+        start_time = chrono::system_clock::now() - cam.frame_time(p);
+    }
+    if (realtime)
+        this_thread::sleep_until(start + cam.frame_time(p));
+    time = start_time + chrono::duration_cast<chrono::system_clock::duration>(cam.frame_time(p));
+    cam.get_image(p, result);
+    pos = p + 1;
+    return true;
+}
+
+uint16_t synthetic_source::celsius_to_raw(double celsius) const
+{
+    return saturate_cast<uint16_t>((celsius - synthetic_camera::temp_offset) /
+                                   synthetic_camera::temp_resolution);
+}
+
+vector<pair<string, double>> synthetic_source::read_component_temps()
+{
+    size_t p = pos;
+    return cam.component_temps(p > 0 ? p - 1 : 0);
+}
+
+void synthetic_source::seek(size_t frame)
+{
+    pos = frame;
+    start = {};
+}
@@ -0,0 +1,27 @@
+#ifndef SYNTHETIC_SOURCE_HPP
+#define SYNTHETIC_SOURCE_HPP
+
+#include "camera_source.hpp"
+#include "synthetic_camera.hpp"
+#include <atomic>
+
+// Images generated by synthetic_camera, delivered at its frame rate
+// (see set_realtime()).
+class synthetic_source : public camera_source {
+public:
+    explicit synthetic_source(const synthetic_camera::params &p);
+
+    capabilities get_capabilities() const override;
+    bool get_image(cv::Mat_<uint16_t> &result, std::chrono::system_clock::time_point &time) override;
+    uint16_t celsius_to_raw(double celsius) const override;
+    std::vector<std::pair<std::string, double>> read_component_temps() override;
+    void seek(size_t frame) override;
+
+private:
+    synthetic_camera cam;
+    std::atomic<size_t> pos{0};
+    std::chrono::steady_clock::time_point start; // Time of frame 0 (for pacing)
+    std::chrono::system_clock::time_point start_time;
+};
+
+#endif // SYNTHETIC_SOURCE_HPP
@@ -0,0 +1,31 @@
+#include "temp_lut.hpp"
+#include <opencv2/core.hpp>
+#include <cmath>
+
+using namespace cv;
+
+double temp_lut::operator()(double raw) const
+{
+    if (std::isnan(raw))
+        return raw;
+    return table[saturate_cast<uint16_t>(raw)];
+}
+
+void temp_lut::to_celsius(const Mat_<uint16_t> &raw, Mat_<float> &celsius) const
+{
+    celsius.create(raw.size());
+    const float *lut = table.data();
+
+    // Table lookup is a gather, which is bound by memory latency
+    // rather than arithmetic. The simple inner loop allows compilers
+    // to use gather instructions (AVX2), and the rows are split
+    // among CPU cores.
+    parallel_for_(Range(0, raw.rows), [&](const Range &rows) {
+        for (int y = rows.start; y < rows.end; y++) {
+            const uint16_t *src = raw[y];
+            float *dst = celsius[y];
+            for (int x = 0; x < raw.cols; x++)
+                dst[x] = lut[src[x]];
+        }
+    });
+}
@@ -0,0 +1,32 @@
+#ifndef TEMP_LUT_HPP
+#define TEMP_LUT_HPP
+
+#include <opencv2/core/mat.hpp>
+#include <cstdint>
+#include <vector>
+
+// Conversion table from raw 16-bit pixel values to °C.
+class temp_lut {
+public:
+    // raw_to_celsius is called for all 65536 possible raw values
+    template <typename F>
+    explicit temp_lut(F raw_to_celsius) : table(1 << 16)
+    {
+        for (size_t raw = 0; raw < table.size(); raw++)
+            table[raw] = raw_to_celsius(uint16_t(raw));
+    }
+
+    float operator[](uint16_t raw) const { return table[raw]; }
+
+    // For non-integer raw values (e.g. averages or interpolated
+    // pixels), the nearest table entry is used.
+    double operator()(double raw) const;
+
+    // Convert the whole frame
+    void to_celsius(const cv::Mat_<uint16_t> &raw, cv::Mat_<float> &celsius) const;
+
+private:
+    std::vector<float> table;
+};
+
+#endif // TEMP_LUT_HPP
@@ -2,12 +2,14 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <err.h>
 #include "point-tracking.hpp"
+#include "hs_kernels.hpp"
+#include "frame_pool.hpp"
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
-#include <boost/accumulators/statistics/rolling_count.hpp>
 #include "Base64.h"
 #include <iostream>
 #include <algorithm>
+#include <mutex>
 
 using namespace std;
 using namespace cv;
@@ -23,20 +25,38 @@ string POI::to_string(bool print_name)
     return ss.str();
 }
 
-thermo_img::thermo_img(cv::Mat_<double> compenzation_img)
+thermo_img::thermo_img(cv::Mat_<double> compenzation_img, hs_config hs_cfg)
     : compenzation_img(compenzation_img)
+    , hs_cfg(hs_cfg)
 {
 }
 
 void thermo_img::update(img_stream &is)
 {
-    is.get_image(rawtemp);
+    frame f;
+    is.get_image(f.rawtemp);
+    f.lut = is.get_lut();
+    f.time = is.get_image_time();
+    f.timestamp = chrono::steady_clock::now();
+    update(is, f);
+}
+
+void thermo_img::update(img_stream &is, const frame &f)
+{
+    rawtemp = f.rawtemp;
+    lut = f.lut;
+    time = f.time;
+    stamps = {};
+    stamps.stamp(frame_stamps::grab, f.timestamp);
 
+    // Copies of the previous frame (webserver, batch rendering jobs)
+    // may still use the old gray buffer, so do not overwrite it, but
+    // take a new one from the pool. convertTo() then writes into it.
+    frame_pool::instance().create(gray, rawtemp.rows, rawtemp.cols, CV_8U);
     rawtemp.convertTo(gray, CV_8U,
                       255.0 / (is.max_rawtemp - is.min_rawtemp),
                       255.0 / (1.0 - double(is.max_rawtemp) / double(is.min_rawtemp)));
 
-    this->is = &is;
     webimgs.clear();
 }
 
@@ -49,6 +69,11 @@ static void imgPrintStrings(Mat& img, cv::Ptr<cv::freetype::FreeType2> ft2,
     int thickness = -1;
     int linestyle = cv::LINE_AA;
 
+    // FreeType2 is not thread safe and the font is shared by all
+    // threads drawing previews.
+    static mutex ft2_mutex;
+    lock_guard<mutex> lk(ft2_mutex);
+
     int bl = 0;
     Size sz = ft2->getTextSize("A", fontHeight, thickness, &bl);
     for (string s : strings) {
@@ -260,8 +285,8 @@ void thermo_img::track(const thermo_img &ref, tracking track)
 {
     double min, max;
     minMaxLoc(rawtemp, &min, &max);
-    if (is) {
-        double temp_diff = is->get_temperature(max) - is->get_temperature(min);
+    if (lut) {
+        double temp_diff = get_temperature(max) - get_temperature(min);
 
         // Switch tracking off when there is too small temperature
         // difference. Tracking does not work well and the tracked
@@ -278,27 +303,21 @@ void thermo_img::track(const thermo_img &ref, tracking track)
         heat_sources_border = ref.heat_sources_border;
         break;
     case tracking::sync:
-        updateKpDesc();
         updatePOICoords(ref);
         break;
     case tracking::async:
-        if (!nc.future.valid() ||
-            nc.future.wait_for(chrono::seconds::zero()) == future_status::ready) {
-            if (nc.future.valid()) {
-                thermo_img tracked = nc.future.get();
-                poi = tracked.poi;
-                heat_sources_border = tracked.heat_sources_border;
-            }
-
-            nc.future = async([&](thermo_img copy) {
-                copy.updateKpDesc();
-                copy.updatePOICoords(ref);
-                return copy;
-            }, *this);
-        }
+        // The worker tracks the newest frame; apply each of its
+        // results once. No images are copied here.
+        if (!nc.tracker)
+            nc.tracker = std::make_unique<tracking_worker>(ref.nc.reference);
+        nc.tracker->post(gray, time);
+        applyTrackingResult(ref);
         break;
     case tracking::finish:
-        nc.future.wait();
+        if (nc.tracker) {
+            nc.tracker->wait_idle();
+            applyTrackingResult(ref);
+        }
         break;
     }
 
@@ -306,43 +325,54 @@ void thermo_img::track(const thermo_img &ref, tracking track)
         point.temp = get_temperature((Point)point.p);
 }
 
-void thermo_img::updateKpDesc()
+void thermo_img::trainMatcher(const tracking_params &params)
 {
-    Mat pre = preprocess(gray);
-    nc.kp = getKeyPoints(pre);
-    nc.desc = getDescriptors(pre, nc.kp);
+    nc.reference = std::make_shared<point_tracker>(gray, params);
 }
 
-void thermo_img::trainMatcher()
+double thermo_img::get_temperature(double raw) const
 {
-    updateKpDesc();
-    ::trainMatcher(nc.desc);
-}
-
-double thermo_img::get_temperature(uint16_t pixel)
-{
-    return is->get_temperature(pixel);
+    if (!lut)
+        return nan("");
+    return (*lut)(raw);
 }
 
 
-double thermo_img::get_temperature(Point p)
+double thermo_img::get_temperature(Point p) const
 {
     if (p.y < 0 || p.y >= height() || p.x < 0 || p.x >= width()) {
         cerr << "Point at (" << p.x << "," << p.y << ") out of image!" << endl;
         return nan("");
     }
-    if (!is)
+    if (!lut)
         return nan("");
 
-    uint16_t pixel = rawtemp(p);
-    return is->get_temperature(pixel);
+    return (*lut)[rawtemp(p)];
 }
 
 void thermo_img::updatePOICoords(const thermo_img &ref)
 {
-    std::vector<cv::DMatch> matches = matchToReference(nc.desc);
-    Mat H = findH(ref.nc.kp, nc.kp, matches);
+    if (!nc.ftracker)
+        nc.ftracker = std::make_unique<frame_tracker>(ref.nc.reference);
+    homography_stats st;
+    Mat H = nc.ftracker->track(gray, &st);
+    applyHomography(ref, H, st);
+}
+
+void thermo_img::applyTrackingResult(const thermo_img &ref)
+{
+    std::shared_ptr<const tracking_worker::result> r = nc.tracker->latest();
+    if (r && r->seq != nc.tracked_seq) {
+        nc.tracked_seq = r->seq;
+        applyHomography(ref, r->H, r->stats);
+    }
+}
 
+// Move POIs and the heat sources border from the reference image
+// according to the homography H
+void thermo_img::applyHomography(const thermo_img &ref, const Mat &H, const homography_stats &st)
+{
+    track_stats = st;
     if (H.empty()) // Couldn't find homography - points stay the same
         return; // FIXME: Let the caller (or at least user) know that this happened
 
@@ -405,10 +435,14 @@ std::string to_string_prec(double v, unsigned prec)
     return ss.str();
 }
 
-static double get_max(const Mat &mat) {
-        double min, max;
-        minMaxLoc(mat, &min, &max);
-        return max;
+static bool same_border(const vector<Point2f> &a, const vector<Point2f> &b, double tolerance)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (norm(a[i] - b[i]) > tolerance)
+            return false;
+    return true;
 }
 
 void thermo_img::calcHeatSources()
@@ -420,53 +454,113 @@ void thermo_img::calcHeatSources()
         }
     }
 
-    const Size sz(100, 100); // Size of heat sources image
-    vector<Point2f> detail_rect = { {0, 0}, {float(sz.width), 0}, {float(sz.width), float(sz.height)}, {0, float(sz.height)} };
+    using precision = hs_config::precision;
+    if (hs_cfg.prec != precision::float32 && !nc.hs64)
+        nc.hs64.reset(new hs_state<double>(hs_cfg));
+    if (hs_cfg.prec != precision::float64 && !nc.hs32)
+        nc.hs32.reset(new hs_state<float>(hs_cfg));
 
-    Mat transform = getPerspectiveTransform(heat_sources_border, detail_rect);
-    Mat raw_float, detail;
-    rawtemp.convertTo(raw_float, CV_64F);
+    switch (hs_cfg.prec) {
+    case precision::float64:
+        calcHeatSources(*nc.hs64, webimgs, hs);
+        break;
+    case precision::float32:
+        calcHeatSources(*nc.hs32, webimgs, hs);
+        break;
+    case precision::check: {
+        // Show the double results, compare the float ones with them
+        Mat detail64, laplacian64, detail32, laplacian32;
+        list<list<webimg>> webimgs32;
+        vector<HeatSource> hs32;
+        calcHeatSources(*nc.hs64, webimgs, hs, &detail64, &laplacian64);
+        calcHeatSources(*nc.hs32, webimgs32, hs32, &detail32, &laplacian32);
+        checkPrecision("detail", detail64, detail32);
+        checkPrecision("laplacian", laplacian64, laplacian32);
+        break;
+    }
+    }
+    hs_memory = hs_cfg.prec == precision::float32 ? nc.hs32->memory() : nc.hs64->memory();
+}
+
+// Warn when the float result deviates from the double one by more
+// than the tolerance (relative to the largest absolute value). Only
+// new maxima are reported to not flood the log.
+void thermo_img::checkPrecision(const string &name, const Mat &res64, const Mat &res32)
+{
+    const double tolerance = 1e-3;
+    Mat res32_64;
+    res32.convertTo(res32_64, CV_64F);
+    double scale = std::max(norm(res64, NORM_INF), 1e-9);
+    double e = norm(res64, res32_64, NORM_INF) / scale;
+    if (e > tolerance && e > nc.max_err32) {
+        warnx("Float heat sources deviate from double: %s relative error %g", name.c_str(), e);
+        nc.max_err32 = e;
+    }
+}
 
-    if (!compenzation_img.empty()) {
-        raw_float -= compenzation_img;
+template <typename T>
+void thermo_img::calcHeatSources(hs_state<T> &s, list<list<webimg>> &webimgs, vector<HeatSource> &hs,
+                                 Mat *detail_out, Mat *laplacian_out)
+{
+    const Size sz(hs_detail_size, hs_detail_size); // Size of heat sources image
+
+    if (!compenzation_img.empty() && s.compenzation.empty())
+        compenzation_img.convertTo(s.compenzation, DataType<T>::depth);
+
+    // The maps need to be recalculated only when the border moves
+    // by more than a half of their resolution (1/32 px)
+    if (!same_border(s.warp_border, heat_sources_border, 0.5 / INTER_TAB_SIZE)) {
+        vector<Point2f> detail_rect = { {0, 0}, {float(sz.width), 0}, {float(sz.width), float(sz.height)}, {0, float(sz.height)} };
+        Mat transform = getPerspectiveTransform(detail_rect, heat_sources_border); // detail → rawtemp
+        Mat_<Point2f> grid(sz), map;
+        for (int y = 0; y < sz.height; y++)
+            for (int x = 0; x < sz.width; x++)
+                grid(y, x) = Point2f(x, y);
+        perspectiveTransform(grid, map, transform);
+        convertMaps(map, noArray(), s.warp_xy, s.warp_frac, CV_16SC2);
+        s.warp_border = heat_sources_border;
+
+        if (!compenzation_img.empty()) {
+            Mat comp;
+            remap(compenzation_img, comp, s.warp_xy, s.warp_frac, INTER_LINEAR);
+            comp.convertTo(s.warp_compenzation, DataType<T>::depth);
+        }
     }
 
-    warpPerspective(raw_float, detail, transform, sz);
+    // Same as warpPerspective() of the compensated image converted
+    // to T, but only the detail pixels are calculated
+    Mat_<T> detail;
+    hs_kernels::remap_sub(rawtemp, s.warp_xy, s.warp_frac, s.warp_compenzation, detail);
     {
-        double min, max;
-        stringstream ss;
+        auto range = [this](double min, double max) {
+            stringstream ss;
+            ss << fixed << setprecision(2) << get_temperature(max) << "–" << get_temperature(min) << "=" <<
+                get_temperature(max) - get_temperature(min) << "°C";
+            return ss.str();
+        };
 
-        minMaxLoc(detail, &min, &max);
-        ss << fixed << setprecision(2) << get_temperature(max) << "–" << get_temperature(min) << "=" <<
-            get_temperature(max) - get_temperature(min) << "°C";
+        s.detail_avg.update(detail);
 
-        list<webimg> detail_list {webimg("detail-current", "Detail", detail, ss.str())};
+        list<webimg> detail_list {webimg("detail-current", "Detail", detail,
+                                         range(s.detail_avg.input_min(), s.detail_avg.input_max()))};
 
-        nc.det_var(MatAutoInit(detail)); // We have to convert the class to enforce use of overloaded operators
-        Mat det_stddev;
-        cv::sqrt(acc::rolling_variance(nc.det_var), det_stddev);
+        s.detail_stats.update(detail);
+        Mat_<T> det_stddev;
+        s.detail_stats.stddev(det_stddev);
 
-        detail_list.emplace_back("detail-stddev", "Det. stddev n="+to_string(acc::rolling_count(nc.det_var)), det_stddev);
+        detail_list.emplace_back("detail-stddev", "Det. stddev n="+to_string(s.detail_stats.count()), det_stddev);
 
 
-        for (auto [i, alpha] : { make_pair(0U, 0.9), {1, 0.99}, {2, 0.997} }) {
-            nc.detail_avg[i] = alpha * nc.detail_avg[i] + (1-alpha) * detail;
-            minMaxLoc(nc.detail_avg[i], &min, &max);
-            ss.str(""s);
-            ss << fixed << setprecision(2) << get_temperature(max) << "–" << get_temperature(min) << "=" <<
-                get_temperature(max) - get_temperature(min) << "°C";
-            detail_list.emplace_back("detail-avg" + to_string(i), "D. avg"+to_string(i)+" α=" + to_string_ntz(alpha),
-                                     nc.detail_avg[i], ss.str());
+        for (unsigned i = 0; i < s.detail_avg.size(); i++) {
+            detail_list.emplace_back("detail-avg" + to_string(i), "D. avg"+to_string(i)+" α=" + to_string_ntz(s.detail_avg.alpha(i)),
+                                     s.detail_avg.avg(i).clone(), range(s.detail_avg.min(i), s.detail_avg.max(i)));
         }
 
         {
-            const double alpha = 0.997;
-            if (raw_avg.empty())
-                raw_float.copyTo(raw_avg);
-            else
-                raw_avg = alpha * raw_avg + (1-alpha) * raw_float;
+            const double alpha = hs_cfg.raw_alpha;
+            hs_kernels::ema(s.raw_avg, rawtemp, s.compenzation, alpha);
 
-            detail_list.emplace_back("raw-avg", "raw avg. α=" + to_string_ntz(alpha), raw_avg);
+            detail_list.emplace_back("raw-avg", "raw avg. α=" + to_string_ntz(alpha), s.raw_avg.clone());
         }
 
         webimgs.emplace_back(detail_list);
@@ -474,23 +568,24 @@ void thermo_img::calcHeatSources()
 
 
 
-    Mat blur, laplacian, hsImg;
+    Mat_<T> centered, blur, laplacian, hsImg;
     const double blur_sigma = 6;
-    GaussianBlur(detail, blur, Size(0, 0), blur_sigma, blur_sigma);
-    Laplacian(blur, laplacian, blur.depth());
-    laplacian *= -1;
-    double lap_max = get_max(laplacian);
-    list<webimg> lapl_list { webimg("laplacian-current", "Laplacian", laplacian, "max: " + to_string_prec(lap_max, 3),
+    // Laplacian does not depend on the absolute level. Subtracting
+    // it keeps float precision for the small differences.
+    detail.convertTo(centered, -1, 1, -mean(detail)[0]);
+    GaussianBlur(centered, blur, Size(0, 0), blur_sigma, blur_sigma);
+    Laplacian(blur, laplacian, blur.depth(), 1, -1);
+    s.lapl_avg.update(laplacian);
+    list<webimg> lapl_list { webimg("laplacian-current", "Laplacian", laplacian, "max: " + to_string_prec(s.lapl_avg.input_max(), 3),
                                     webimg::PosNegColorMap::scale_max) };
-    nc.lap_var(MatAutoInit(laplacian)); // We have to convert the class to enforce use of overloaded operators
-    Mat lap_stddev;
-    cv::sqrt(acc::rolling_variance(nc.lap_var), lap_stddev);
-    lapl_list.emplace_back("laplacian-stddev", "Lap. stddev n="+to_string(acc::rolling_count(nc.lap_var)), lap_stddev);
-
-    for (auto [i, alpha] : { make_pair(0U, 0.9), {1, 0.99}, {2, 0.997} }) {
-        nc.lapl_avg[i] = alpha * nc.lapl_avg[i] + (1-alpha) * laplacian;
-        lapl_list.emplace_back("lapl-avg" + to_string(i), "∇²avg"+to_string(i)+" α=" + to_string_ntz(alpha), nc.lapl_avg[i],
-                               "max: " + to_string_prec(get_max(nc.lapl_avg[i]), 3),
+    s.lapl_stats.update(laplacian);
+    Mat_<T> lap_stddev;
+    s.lapl_stats.stddev(lap_stddev);
+    lapl_list.emplace_back("laplacian-stddev", "Lap. stddev n="+to_string(s.lapl_stats.count()), lap_stddev);
+
+    for (unsigned i = 0; i < s.lapl_avg.size(); i++) {
+        lapl_list.emplace_back("lapl-avg" + to_string(i), "∇²avg"+to_string(i)+" α=" + to_string_ntz(s.lapl_avg.alpha(i)), s.lapl_avg.avg(i).clone(),
+                               "max: " + to_string_prec(s.lapl_avg.max(i), 3),
                                webimg::PosNegColorMap::scale_max);
     }
     webimgs.push_back(lapl_list);
@@ -500,73 +595,65 @@ void thermo_img::calcHeatSources()
 
     list<webimg> hs_list { webimg("heat_sources-current", "Heat sources", hsImg) };
 
-    for (auto [i, alpha] : { make_pair(0U, 0.9), {1, 0.99}, {2, 0.999} }) {
-        nc.hsAvg[i] = alpha * nc.hsAvg[i] + (1-alpha) * hsImg;
-
+    s.hsAvg.update(hsImg);
+    for (unsigned i = 0; i < s.hsAvg.size(); i++) {
         Mat hs_log;
         // Make the dark colors more visible
-        cv::log(0.001+nc.hsAvg[i], hs_log);
-        //cv::sqrt(nc.hsAvg[i], hs_log);
-        hs_list.emplace_back("hs-avg" + to_string(i), "HS avg. α=" + to_string_ntz(alpha), hs_log);
+        cv::log(0.001+s.hsAvg.avg(i), hs_log);
+        //cv::sqrt(s.hsAvg.avg(i), hs_log);
+        hs_list.emplace_back("hs-avg" + to_string(i), "HS avg. α=" + to_string_ntz(s.hsAvg.alpha(i)), hs_log);
     }
 
     webimgs.push_back(hs_list);
 
     const auto offset = 0.025;
-    Mat lapgz;
-    Mat lapx = laplacian - offset;
-    lapx.copyTo(lapgz, lapx > 0.0);
+    Mat_<T> lapgz;
+    hs_kernels::positive_part<T>(laplacian, offset, lapgz);
+    s.lapgz_avg.update(lapgz);
     list<webimg> lapgz_list { webimg("lapgz", "L⁺ = Lapl. > " + to_string_ntz(offset), lapgz,
-                                     "max: " + to_string_prec(get_max(lapgz), 3)) };
+                                     "max: " + to_string_prec(s.lapgz_avg.input_max(), 3)) };
 
-    for (auto [i, alpha] : { make_pair(0U, 0.9), {1, 0.99}, {2, 0.997} }) {
-        nc.lapgz_avg[i] = alpha * nc.lapgz_avg[i] + (1-alpha) * lapgz;
-        lapgz_list.emplace_back("lapgz-avg" + to_string(i), "L⁺avg"+to_string(i)+" α=" + to_string_ntz(alpha), nc.lapgz_avg[i],
-                                "max: " + to_string_prec(get_max(nc.lapgz_avg[i]), 3));
+    for (unsigned i = 0; i < s.lapgz_avg.size(); i++) {
+        lapgz_list.emplace_back("lapgz-avg" + to_string(i), "L⁺avg"+to_string(i)+" α=" + to_string_ntz(s.lapgz_avg.alpha(i)), s.lapgz_avg.avg(i).clone(),
+                                "max: " + to_string_prec(s.lapgz_avg.max(i), 3));
     }
 
-    nc.hs_acc(lapgz);
-    lapgz_list.emplace_back("lapgz-mean", "L⁺ mean n=1000", acc::rolling_mean(nc.hs_acc),
-                         "max: " + to_string_prec(get_max(lapgz), 3));
+    s.lapgz_stats.update(lapgz);
+    Mat_<T> lapgz_mean;
+    s.lapgz_stats.mean(lapgz_mean);
+    lapgz_list.emplace_back("lapgz-mean", "L⁺ mean n=" + to_string(s.lapgz_stats.count()), lapgz_mean,
+                         "max: " + to_string_prec(s.lapgz_avg.input_max(), 3));
 
     webimgs.push_back(lapgz_list);
 
     list<webimg> diff_list;
 
-    Mat diff;
-    double dmin, dmax;
-
-    diff = nc.lapgz_avg[0] - nc.lapgz_avg[1];
-    minMaxLoc(diff, &dmin, &dmax);
-    diff_list.emplace_back("lapl-diff", "L⁺avg0 – L⁺avg1", diff,
-                           "max: " + to_string_prec(dmax, 3) + ", " +
-                           "min: " + to_string_prec(dmin, 3),
-                           webimg::PosNegColorMap::scale_both);
+    // The default description shows the range of the differences
+    if (s.lapgz_avg.size() > 1) {
+        Mat diff = s.lapgz_avg.avg(0) - s.lapgz_avg.avg(1);
+        diff_list.emplace_back("lapl-diff", "L⁺avg0 – L⁺avg1", diff, "",
+                               webimg::PosNegColorMap::scale_both);
+    }
 
-    for (unsigned i : {1, 2}) {
-        diff = nc.lapl_avg[i-1] - nc.lapl_avg[i];
-        minMaxLoc(diff, &dmin, &dmax);
+    for (unsigned i = 1; i < s.lapl_avg.size(); i++) {
+        Mat diff = s.lapl_avg.avg(i-1) - s.lapl_avg.avg(i);
         diff_list.emplace_back("fulllapl-diff" + ((i > 1) ? to_string(i-1) : ""),
-                               "∇²avg" + to_string(i-1) + " – ∇²avg" + to_string(i), diff,
-                               "max: " + to_string_prec(dmax, 3) + ", " +
-                               "min: " + to_string_prec(dmin, 3),
+                               "∇²avg" + to_string(i-1) + " – ∇²avg" + to_string(i), diff, "",
                                webimg::PosNegColorMap::scale_both);
     }
     webimgs.push_back(diff_list);
 //     {
-//         int i=0;
 //         list<webimg> lap_list;
-//         for (const Mat &detail : nc.detail_avg)
+//         for (unsigned i = 0; i < s.detail_avg.size(); i++)
 //         {
 //             Mat blur, laplacian;
 //             const double blur_sigma = 4;
-//             GaussianBlur(detail, blur, Size(0, 0), blur_sigma, blur_sigma);
+//             GaussianBlur(s.detail_avg.avg(i), blur, Size(0, 0), blur_sigma, blur_sigma);
 //             Laplacian(blur, laplacian, blur.depth());
 //             laplacian *= -1;
 //             double lap_max = get_max(laplacian);
 //             lap_list.emplace_back("lap-det-avg"+to_string(i), "∇²(D.avg"+to_string(i)+")", laplacian, "max: " + to_string_prec(lap_max, 3),
 //                                   webimg::PosNegColorMap::scale_max);
-//             i++;
 //         }
 //         webimgs.push_back(lap_list);
 //     }
@@ -575,11 +662,16 @@ void thermo_img::calcHeatSources()
     size_t max_hs = 0;
     for (unsigned i=0; i<lm.size(); i++) {
         hs[i].location = lm[i];
-        hs[i].temperature = get_temperature(detail.at<double>(lm[i]));
-        hs[i].neg_laplacian = laplacian.at<double>(lm[i]);
+        hs[i].temperature = get_temperature(detail(lm[i]));
+        hs[i].neg_laplacian = laplacian(lm[i]);
         if (hs[i].neg_laplacian > hs[max_hs].neg_laplacian)
             max_hs = i;
     }
+
+    if (detail_out)
+        *detail_out = detail;
+    if (laplacian_out)
+        *laplacian_out = laplacian;
 }
 
 const std::vector<cv::Point2f> &thermo_img::get_heat_sources_border() const
@@ -587,6 +679,19 @@ const std::vector<cv::Point2f> &thermo_img::get_heat_sources_border() const
     return heat_sources_border;
 }
 
+std::vector<cv::Point2f> thermo_img::get_heat_sources_in_frame() const
+{
+    std::vector<Point2f> in, out;
+    if (hs.empty() || heat_sources_border.size() != 4)
+        return out;
+    const float s = hs_detail_size;
+    vector<Point2f> detail_rect = { {0, 0}, {s, 0}, {s, s}, {0, s} };
+    for (const auto &h : hs)
+        in.push_back(h.location);
+    perspectiveTransform(in, out, getPerspectiveTransform(detail_rect, heat_sources_border));
+    return out;
+}
+
 const std::vector<POI> &thermo_img::get_poi() const
 {
     return poi;
@@ -626,7 +731,7 @@ const thermo_img::webimg *thermo_img::get_webimg(string key) const
 const Mat thermo_img::get_rgb(string key) const
 {
     const webimg *si = get_webimg(key);
-    return si ? si->rgb : Mat();
+    return si ? si->rgb() : Mat();
 }
 
 const cv::Mat thermo_img::get_detail() const
@@ -664,18 +769,47 @@ cv::Mat_<uint16_t> thermo_img::get_rawtemp() const
     return rawtemp;
 }
 
+std::chrono::system_clock::time_point thermo_img::get_time() const
+{
+    return time;
+}
+
+cv::Mat_<float> thermo_img::get_celsius() const
+{
+    Mat_<float> celsius;
+    if (lut)
+        lut->to_celsius(rawtemp, celsius);
+    return celsius;
+}
+
 template <typename CM>
 thermo_img::webimg::webimg(string name, string title, const Mat &mat, string desc, CM cmap)
     : name(name)
     , title(title)
     , mat(mat)
-    , rgb(normalize(mat, cmap))
-    , html_desc(desc)
+    , cache(make_shared<lazy>())
 {
-    double min, max;
-    minMaxLoc(mat, &min, &max);
-    if (html_desc.empty())      // default desc
-        html_desc = "max: " + to_string_prec(max, 3) + ", min: " + to_string_prec(min, 3);
+    cache->render = [cmap](const Mat &m) { return normalize(m, cmap); };
+    cache->desc = desc;
+}
+
+Mat thermo_img::webimg::rgb() const
+{
+    lock_guard<mutex> lk(cache->mtx);
+    if (cache->rgb.empty() && !mat.empty())
+        cache->rgb = cache->render(mat);
+    return cache->rgb;
+}
+
+string thermo_img::webimg::html_desc() const
+{
+    lock_guard<mutex> lk(cache->mtx);
+    if (cache->desc.empty()) {      // default desc
+        double min, max;
+        minMaxLoc(mat, &min, &max);
+        cache->desc = "max: " + to_string_prec(max, 3) + ", min: " + to_string_prec(min, 3);
+    }
+    return cache->desc;
 }
 
 Mat thermo_img::webimg::normalize(Mat in, enum ColormapTypes cmap)
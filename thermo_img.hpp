@@ -5,14 +5,19 @@
 #include <vector>
 #include <array>
 #include "img_stream.hpp"
+#include "capture.hpp"
+#include "latency.hpp"
+#include "hs_kernels.hpp"
+#include "rolling_stats.hpp"
+#include "tracking_worker.hpp"
+#include "point-tracking.hpp"
 #include <boost/accumulators/statistics/rolling_variance.hpp>
-#include <boost/accumulators/statistics/rolling_mean.hpp>
-#include <boost/accumulators/statistics/rolling_moment.hpp>
-#include "custom_accumulators.hpp"
 #include <opencv2/freetype.hpp>
 #include <list>
 #include <opencv2/imgproc.hpp>
-#include <future>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 struct HeatSource {
     cv::Point location;
@@ -39,15 +44,33 @@ struct POI {
 
 enum draw_mode { FULL, TEMP, NUM };
 
+// Settings of heat sources detection (see thermo_img::calcHeatSources())
+struct hs_config {
+    // Floating point type used by the calculation; check calculates
+    // both and warns when the float results deviate
+    enum class precision { float64, float32, check };
+    precision prec = precision::float64;
+
+    // Smoothing factors of the averaged detail, Laplacian and L⁺ images
+    std::vector<double> alphas { 0.9, 0.99, 0.997 };
+    // Smoothing factors of the averaged heat source images
+    std::vector<double> hs_alphas { 0.9, 0.99, 0.999 };
+    // Smoothing factor of the averaged raw image
+    double raw_alpha = 0.997;
+
+    // Rolling windows of the L⁺ mean and of the detail and Laplacian
+    // standard deviations
+    rolling_window mean_window { 1000 };
+    rolling_window stddev_window { 100 };
+};
+
 struct thermo_img {
 public:
     enum class tracking { off, copy, sync, async, finish };
     struct webimg {
         std::string name;
         std::string title;
-        cv::Mat mat; // original (float) image (if any)
-        cv::Mat rgb; // rgb image
-        std::string html_desc;
+        cv::Mat mat; // original (float) image (if any), must not be modified later
 
         enum class PosNegColorMap { scale_both, scale_max }; // for CM below
 
@@ -55,16 +78,32 @@ public:
         webimg(std::string name, std::string title, const cv::Mat &mat, std::string desc, CM cmap);
         webimg(std::string name, std::string title, const cv::Mat &mat, std::string desc = "") :
             webimg(name, title, mat, desc, cv::COLORMAP_INFERNO) {}
+
+        // The rgb image and the default description (value range)
+        // are calculated on first use. Copies of the webimg share
+        // them, so each image of a frame is rendered at most once.
+        // Thread safe.
+        cv::Mat rgb() const;
+        std::string html_desc() const;
     private:
+        struct lazy {
+            std::mutex mtx;
+            std::function<cv::Mat(const cv::Mat &)> render;
+            cv::Mat rgb;
+            std::string desc;
+        };
+        std::shared_ptr<lazy> cache;
+
         static cv::Mat normalize(cv::Mat mat, enum cv::ColormapTypes cmap);
         static cv::Mat normalize(cv::Mat mat, PosNegColorMap pn);
     };
 
-    thermo_img(cv::Mat_<double> compenzation_img = {});
+    thermo_img(cv::Mat_<double> compenzation_img = {}, hs_config hs_cfg = {});
     thermo_img(const thermo_img&) = default;
     thermo_img& operator =(const thermo_img&) = default;
 
     void update(img_stream &is);
+    void update(img_stream &is, const frame &f);
 
     void draw_preview(draw_mode mode, cv::Ptr<cv::freetype::FreeType2> ft2);
 
@@ -73,11 +112,11 @@ public:
     void add_poi(POI &&p);
     void pop_poi();
 
-    void trainMatcher();
+    void trainMatcher(const tracking_params &params = {});
     void track(const thermo_img &ref, tracking track);
 
-    double get_temperature(uint16_t pixel);
-    double get_temperature(cv::Point p);
+    double get_temperature(double raw) const;
+    double get_temperature(cv::Point p) const;
     void updatePOICoords(const thermo_img &ref);
 
     const std::vector<cv::Point2f> &get_heat_sources_border() const;
@@ -85,6 +124,12 @@ public:
     const std::vector<POI> &get_poi() const;
 
     cv::Mat_<uint16_t> get_rawtemp() const;
+    std::chrono::system_clock::time_point get_time() const;
+
+    // Record that the frame passed the given processing stage
+    void stamp(frame_stamps::stage s, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) { stamps.stamp(s, now); }
+    const frame_stamps &get_stamps() const { return stamps; }
+    cv::Mat_<float> get_celsius() const;
     cv::Mat get_gray() const;
 
     int height() const;
@@ -100,31 +145,67 @@ public:
     const cv::Mat get_hs_img() const;
     const cv::Mat get_hs_avg() const;
 
+    // Locations of heat sources are in the detail image (of size
+    // hs_detail_size) spanned by the heat sources border
     const std::vector<HeatSource> &get_heat_sources() const;
+    // Locations of heat sources in the frame (rawtemp) coordinates
+    std::vector<cv::Point2f> get_heat_sources_in_frame() const;
+    static constexpr int hs_detail_size = 100;
+
+    // Memory used by the rolling statistics of heat sources detection
+    // [bytes], by image name
+    const std::vector<std::pair<std::string, size_t>> &get_hs_memory() const { return hs_memory; }
+    const homography_stats &get_track_stats() const { return track_stats; }
 
     const cv::Mat &get_preview() const;
 
 private:
-    img_stream *is = nullptr;
+    std::shared_ptr<const temp_lut> lut; // Raw → °C conversion for rawtemp
 
     cv::Mat_<uint16_t> rawtemp;
+    std::chrono::system_clock::time_point time; // When rawtemp was grabbed
+    frame_stamps stamps;
     cv::Mat preview;
     cv::Mat gray;
     cv::Mat_<double> compenzation_img;
-    cv::Mat_<double> raw_avg;
+    hs_config hs_cfg;
 
     std::list<std::list<webimg>> webimgs;
     std::vector<HeatSource> hs;
-
-    struct MatAutoInit : public cv::Mat_<double> {
-        MatAutoInit(double init_val = 0.0) : cv::Mat_<double>(100, 100, init_val) {};
-        using cv::Mat_<double>::Mat_;
-
-        // To use boost::accumulators::rolling_variance, we need * to
-        // be per-element multiplication, not matrix multiplication
-        MatAutoInit operator*(const MatAutoInit& rhs) { return this->mul(rhs); }
-        // ... and  division should return the same type, not MatExpr.
-        MatAutoInit operator/(std::size_t rhs) { return *this / rhs; }
+    std::vector<std::pair<std::string, size_t>> hs_memory;
+
+    // State of calcHeatSources() with images of type T
+    template <typename T>
+    struct hs_state {
+        explicit hs_state(const hs_config &cfg)
+            : detail_avg(cfg.alphas, 7231) // Default value ≅ 15°C
+            , lapl_avg(cfg.alphas)
+            , hsAvg(cfg.hs_alphas)
+            , lapgz_avg(cfg.alphas)
+            , detail_stats(cfg.stddev_window)
+            , lapl_stats(cfg.stddev_window)
+            , lapgz_stats(cfg.mean_window, false)
+        {}
+
+        // Memory used by the rolling statistics [bytes], by the name
+        // of the image calculated from them
+        std::vector<std::pair<std::string, size_t>> memory() const
+        {
+            return { { "detail-stddev", detail_stats.memory() },
+                     { "laplacian-stddev", lapl_stats.memory() },
+                     { "lapgz-mean", lapgz_stats.memory() } };
+        }
+
+        hs_kernels::ema_bank<T> detail_avg, lapl_avg, hsAvg, lapgz_avg;
+        rolling_stats<T> detail_stats, lapl_stats, lapgz_stats;
+
+        cv::Mat_<T> raw_avg;
+        cv::Mat_<T> compenzation; // compenzation_img converted to T
+
+        // Cached mapping of the heat sources area to the detail image
+        std::vector<cv::Point2f> warp_border; // heat_sources_border used to calculate the maps
+        cv::Mat warp_xy, warp_frac;           // Fixed-point maps (see cv::convertMaps)
+        cv::Mat_<T> warp_compenzation;        // compenzation_img mapped to the detail image
     };
 
     // these values are not copied to webserver
@@ -133,35 +214,33 @@ private:
         nocopy(const nocopy &nc) {} // noop copy constructor
         nocopy& operator=(const nocopy&) { return *this; } // noop copy assignment operator
 
-        // Acumulators for calculation of average images (we use lazy
-        // variant, because the immediate one does not work with
-        // cv::Mat, perhaps because it's not possible to nest
-        // cv::MatExpr, which would result from the calculations used
-        // by the immediate version)
-        using acc_mat_rolling_mean = boost::accumulators::accumulator_set<MatAutoInit, boost::accumulators::stats<boost::accumulators::tag::lazy_rolling_mean>>;
-        acc_mat_rolling_mean hs_acc {boost::accumulators::tag::rolling_window::window_size = 1000};
-
+        // Allocated on first use (copies of thermo_img do not need them)
+        std::unique_ptr<hs_state<double>> hs64;
+        std::unique_ptr<hs_state<float>> hs32;
+        double max_err32 = 0; // Largest deviation of float results seen (hs_config::precision::check)
 
-        using acc_mat_rolling_var = boost::accumulators::accumulator_set<MatAutoInit, boost::accumulators::stats<boost::accumulators::tag::really_lazy_rolling_variance>>;
-        acc_mat_rolling_var det_var {boost::accumulators::tag::rolling_window::window_size = 100};
-        acc_mat_rolling_var lap_var {boost::accumulators::tag::rolling_window::window_size = 100};
+        // Trained on the reference image (see trainMatcher())
+        std::shared_ptr<point_tracker> reference;
 
-        std::array<MatAutoInit, 3> detail_avg {7231, 7231, 7231}; // Default value ≅ 15°C
-        std::array<MatAutoInit, 3> lapl_avg;
-        std::array<MatAutoInit, 3> hsAvg;
-        std::array<MatAutoInit, 3> lapgz_avg;
+        // Background point tracking (tracking::async) and the last
+        // applied result
+        std::unique_ptr<tracking_worker> tracker;
+        unsigned long tracked_seq = 0;
 
-        std::vector<cv::KeyPoint> kp;
-        cv::Mat desc;
-
-        // Result of background point tracking calculation (tracking::async)
-        std::future<thermo_img> future;
+        std::unique_ptr<frame_tracker> ftracker; // Synchronous tracking
     } nc;
 
     std::vector<POI> poi; // Points of interest
     std::vector<cv::Point2f> heat_sources_border;
+    homography_stats track_stats; // Of the last applied tracking result
+
+    void applyHomography(const thermo_img &ref, const cv::Mat &H, const homography_stats &st);
+    void applyTrackingResult(const thermo_img &ref);
 
-    void updateKpDesc();
+    template <typename T>
+    void calcHeatSources(hs_state<T> &s, std::list<std::list<webimg>> &webimgs, std::vector<HeatSource> &hs,
+                         cv::Mat *detail_out = nullptr, cv::Mat *laplacian_out = nullptr);
+    void checkPrecision(const std::string &name, const cv::Mat &res64, const cv::Mat &res32);
 };
 
 cv::Mat drawPOI(cv::Mat in, cv::Ptr<cv::freetype::FreeType2> ft2, std::vector<POI> poi, draw_mode mode);
@@ -2,6 +2,8 @@
 #include "webserver.hpp"
 
 #include "arg-parse.hpp"
+#include "capture.hpp"
+#include "thread_pool.hpp"
 #include <err.h>
 #include <unistd.h>
 #include <time.h>
@@ -18,9 +20,13 @@
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/calib3d.hpp>
 #include <opencv2/freetype.hpp>
+#include <opencv2/videoio.hpp>
 
 #include <numeric>
 #include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
 
 #include "config.h"
 
@@ -63,7 +69,8 @@ void signalHandler(int signal_num)
 
 cv::Ptr<cv::freetype::FreeType2> ft2;
 
-void setRefStatus(thermo_img &ref, img_stream &is, string poi_filename, bool tracking_on, string heat_sources_border_points)
+void setRefStatus(thermo_img &ref, img_stream &is, string poi_filename, bool tracking_on, string heat_sources_border_points,
+                  const tracking_params &tp)
 {
     if (poi_filename.empty()) {
         ref.update(is);
@@ -71,7 +78,7 @@ void setRefStatus(thermo_img &ref, img_stream &is, string poi_filename, bool tra
         ref.read_from_poi_json(poi_filename, heat_sources_border_points);
     }
     if (tracking_on) {
-        ref.trainMatcher(); // train once on reference image
+        ref.trainMatcher(tp); // train once on reference image
     }
 }
 
@@ -104,16 +111,16 @@ string csvHeaderPOI(vector<POI> poi){
     return s;
 }
 
-string csvRowPOI(vector<POI> poi){
+string csvRowPOI(vector<POI> poi, chrono::system_clock::time_point time){
     stringstream ss;
-    ss << clkDateTimeString(chrono::system_clock::now());
+    ss << clkDateTimeString(time);
     for (unsigned i = 0; i < poi.size(); i++)
         ss << ", " << fixed << setprecision(2) << poi[i].temp;
     ss << endl;
     return ss.str();
 }
 
-void printPOITemp(vector<POI> poi, string file)
+void printPOITemp(vector<POI> poi, chrono::system_clock::time_point time, string file)
 {
     if (poi.size() == 0)
         return;
@@ -122,34 +129,98 @@ void printPOITemp(vector<POI> poi, string file)
         string str;
         if (access(file.c_str(), F_OK) == -1) // File does not exist
             str += csvHeaderPOI(poi);
-        str += csvRowPOI(poi);
+        str += csvRowPOI(poi, time);
         ofstream f(file, ofstream::app);
         f << str;
         f.close();
     }
 }
 
-void processNextFrame(img_stream &is, const thermo_img &ref, thermo_img &curr,
-                      string window_name, VideoWriter *vw,
-                      string poi_csv_file, thermo_img::tracking track)
+/* Time spent in individual processing stages */
+class stage_times {
+public:
+    enum stage { update, track, heat_sources, preview, output, count };
+
+    // Add time elapsed since `since` to stage s and return current time.
+    chrono::steady_clock::time_point lap(stage s, chrono::steady_clock::time_point since)
+    {
+        auto now = chrono::steady_clock::now();
+        ns[s] += chrono::duration_cast<chrono::nanoseconds>(now - since).count();
+        return now;
+    }
+
+    void report(const string &name, uint64_t frames, chrono::steady_clock::duration wall) const
+    {
+        static const char *names[count] = { "update", "track", "heat sources", "preview", "output" };
+        static mutex report_mutex; // Do not mix reports of multiple cameras
+        lock_guard<mutex> lk(report_mutex);
+        double wall_s = chrono::duration<double>(wall).count();
+
+        fprintf(stderr, "%sProcessed %lu frames in %.2f s (%.2f frames/s)\n", name.c_str(),
+                (unsigned long)frames, wall_s, wall_s > 0 ? frames / wall_s : 0.0);
+        for (int i = 0; i < count; i++) {
+            double total_s = ns[i] / 1e9;
+            fprintf(stderr, "  %-13s %9.2f s total %8.3f ms/frame\n",
+                    names[i], total_s, frames ? total_s * 1e3 / frames : 0.0);
+        }
+    }
+
+private:
+    array<atomic<uint64_t>, count> ns {};
+};
+
+// Stages, which depend on the previous frame (tracking, averaging of
+// heat source images). These must run in frame order.
+void processNextFrame(const frame &f, img_stream &is, const thermo_img &ref, thermo_img &curr,
+                      thermo_img::tracking track, stage_times &st)
 {
-    curr.update(is);
+    auto t = chrono::steady_clock::now();
 
-    curr.track(ref, track);
+    curr.update(is, f);
+    t = st.lap(stage_times::update, t);
+    curr.stamp(frame_stamps::update, t);
 
-    printPOITemp(curr.get_poi(), poi_csv_file);
+    curr.track(ref, track);
+    t = st.lap(stage_times::track, t);
+    curr.stamp(frame_stamps::track, t);
 
     if (curr.get_heat_sources_border().size() > 0) {
         curr.calcHeatSources();
     }
+    t = st.lap(stage_times::heat_sources, t);
+    curr.stamp(frame_stamps::heat_sources, t);
+}
+
+// Stages, which depend only on the given frame. In batch mode, they
+// run for several frames in parallel.
+void renderFrame(thermo_img &curr, bool save_img, const string &save_img_prefix, stage_times &st)
+{
+    auto t = chrono::steady_clock::now();
 
     curr.draw_preview(curr_draw_mode, ft2);
 
+    if (save_img) {
+        string time = clkDateTimeString(curr.get_time());
+        imwrite(save_img_prefix + time + ".png", curr.get_gray());
+        imwrite(save_img_prefix + "raw_" + time + ".png", curr.get_rawtemp());
+    }
+    t = st.lap(stage_times::preview, t);
+    curr.stamp(frame_stamps::preview, t);
+}
+
+// Stages with shared outputs. These must run in frame order.
+void outputFrame(const thermo_img &curr, unsigned cam, string window_name, VideoWriter *vw,
+                 string poi_csv_file, thermo_img::tracking track, stage_times &st)
+{
+    auto t = chrono::steady_clock::now();
+
+    printPOITemp(curr.get_poi(), curr.get_time(), poi_csv_file);
+
     if (vw)
         vw->write(track != thermo_img::tracking::off ? curr.get_preview() : curr.get_gray());
 
     if (webserver) {
-        webserver->update(curr);
+        webserver->update(curr, cam);
     }
 
     if (gui_available) {
@@ -172,6 +243,7 @@ void processNextFrame(img_stream &is, const thermo_img &ref, thermo_img &curr,
         }
         imshow(window_name, img);
     }
+    st.lap(stage_times::output, t);
 }
 
 bool handle_input(bool enter_poi, thermo_img &ref)
@@ -194,37 +266,42 @@ bool handle_input(bool enter_poi, thermo_img &ref)
     return is_exit;
 }
 
-void processStream(img_stream &is, thermo_img &ref, thermo_img &curr, cmd_arguments &args)
+void processStream(img_stream &is, thermo_img &ref, thermo_img &curr, const cmd_arguments &args,
+                   unsigned cam, thread_pool *pool)
 {
+    const cmd_arguments::camera &cam_args = args.cameras[cam];
+    bool multi = args.cameras.size() > 1;
+    string cam_name = multi ? "cam" + to_string(cam) : "";
+    string save_img_prefix = args.save_img_dir + "/" + (multi ? cam_name + "_" : "");
     int exit = 0;
     VideoWriter *vw = nullptr;
     string window_name = "Thermocam-PCB";
     chrono::time_point<chrono::system_clock> save_img_clk;
-    chrono::time_point<chrono::system_clock> cam_temp_update_time;
+    shared_ptr<const camera_temps> cam_temps;
+    stage_times st;
+    uint64_t frames = 0;
 
     if (gui_available)
         namedWindow(window_name, WINDOW_NORMAL);
     if (gui_available && args.enter_poi)
         setMouseCallback(window_name, onMouse, &ref);
-    if (!args.vid_out_path.empty()) {
+    if (!cam_args.vid_out_path.empty()) {
         int scale = args.tracking != cmd_arguments::tracking::off ? 2 : 1;
         bool isColor = args.tracking != cmd_arguments::tracking::off;
         string cc = args.fourcc;
-        vw = new VideoWriter(args.vid_out_path,
+        double fps = is.get_capabilities().fps;
+        vw = new VideoWriter(cam_args.vid_out_path,
                              cv::VideoWriter::fourcc(cc[0], cc[1], cc[2], cc[3]),
-                CAM_FPS, Size(ref.width()*scale, ref.height()*scale),
+                fps > 0 ? fps : CAM_FPS, Size(ref.width()*scale, ref.height()*scale),
                 isColor);
         if (!vw->isOpened()) {
-            warnx("VideoWriter for %s not available", args.vid_out_path.c_str());
+            warnx("VideoWriter for %s not available", cam_args.vid_out_path.c_str());
             return;
         }
     }
 
     bool watchdog_enabled = sd_watchdog_enabled(true, NULL) > 0;
 
-    if (args.save_img)
-        save_img_clk = chrono::system_clock::now();
-
     thermo_img::tracking track = thermo_img::tracking::off;
 
     switch (args.tracking) {
@@ -240,52 +317,118 @@ void processStream(img_stream &is, thermo_img &ref, thermo_img &curr, cmd_argume
         track = thermo_img::tracking::sync;
         break;
     case cmd_arguments::tracking::background:
-        track = thermo_img::tracking::async;
+        // Background tracking would skip frames in batch mode
+        track = args.batch ? thermo_img::tracking::sync : thermo_img::tracking::async;
+        break;
+    }
+
+    // In batch mode, frames are rendered in parallel by the pool and
+    // output in order from the pending queue.
+    deque<future<thermo_img>> pending;
+    if (args.batch) {
+        is.set_loop(false);
+        is.set_realtime(false);
+    }
+    auto output_pending = [&](size_t keep) {
+        while (pending.size() > keep) {
+            thermo_img ti = pending.front().get();
+            pending.pop_front();
+            outputFrame(ti, cam, window_name, vw, cam_args.poi_csv_file, track, st);
+        }
+    };
+
+    capture::mode mode = is.is_live() && !args.batch ? capture::mode::latest : capture::mode::every;
+    switch (args.frame_mode) {
+    case cmd_arguments::frame_mode::automatic:
+        break;
+    case cmd_arguments::frame_mode::latest:
+        mode = capture::mode::latest;
+        break;
+    case cmd_arguments::frame_mode::every:
+        mode = capture::mode::every;
         break;
     }
+    unique_ptr<raw_writer> rec;
+    if (!cam_args.raw_out_path.empty())
+        rec.reset(new raw_writer(cam_args.raw_out_path, ref.width(), ref.height(), args.raw_out_append));
+
+    capture cap(is, mode, rec.get());
+    auto start_time = chrono::steady_clock::now();
 
     while (!exit || track == thermo_img::tracking::finish) {
         if (watchdog_enabled)
             sd_notify(false, "WATCHDOG=1");
+
+        frame f;
+        // Do not wait for frames forever to stay responsive to user input
+        bool have_frame = cap.next(f, chrono::milliseconds(500));
+
         auto begin = chrono::system_clock::now();
 
-        processNextFrame(is, ref, curr, window_name, vw,
-                         args.poi_csv_file, track);
+        if (have_frame) {
+            frames++;
+            processNextFrame(f, is, ref, curr, track, st);
+
+            // Period of saving images is measured in frame time to
+            // get the same result in batch mode.
+            if (save_img_clk == chrono::system_clock::time_point())
+                save_img_clk = f.time;
+            bool save_img = args.save_img &&
+                duration_us(save_img_clk, f.time) > args.save_img_period * 1000000;
+            if (save_img)
+                save_img_clk = f.time;
+
+            if (pool) {
+                pending.push_back(pool->submit([ti = curr, save_img, &save_img_prefix, &st]() mutable {
+                    renderFrame(ti, save_img, save_img_prefix, st);
+                    return ti;
+                }));
+            } else {
+                renderFrame(curr, save_img, save_img_prefix, st);
+                outputFrame(curr, cam, window_name, vw, cam_args.poi_csv_file, track, st);
+            }
+        }
+
+        // Keep at most one queued frame per worker thread
+        if (pool)
+            output_pending(pool->size());
 
         auto end = chrono::system_clock::now();
 
-        if (args.tracking == cmd_arguments::tracking::once)
+        if (webserver)
+            webserver->update_capture_stats(cap.get_stats(), cam);
+
+        if (have_frame && args.tracking == cmd_arguments::tracking::once)
             track = thermo_img::tracking::off;
 
-        if (track == thermo_img::tracking::finish)
+        if (have_frame && track == thermo_img::tracking::finish)
             break;
 
-        exit = handle_input(args.enter_poi, ref);
+        exit = handle_input(args.enter_poi, ref) || (args.batch && cap.finished());
 
         if (exit && track == thermo_img::tracking::async)
             track = thermo_img::tracking::finish; // Wait until async computation finishes
 
-        if (args.save_img &&
-                duration_us(save_img_clk, end) > args.save_img_period * 1000000) {
-            save_img_clk = chrono::system_clock::now();
-            string img_path = args.save_img_dir + "/"
-                              + clkDateTimeString(save_img_clk) + ".png";
-            imwrite(img_path, curr.get_gray());
-            imwrite(args.save_img_dir + "/raw_" + clkDateTimeString(save_img_clk) + ".png", curr.get_rawtemp());
-        }
-
-        // Update camera internal temperatures. Since it takes
-        // about 120 ms, we do it only once per minute.
-        if (webserver && end - cam_temp_update_time > 1min) {
-            webserver->update_temps(is.getCameraComponentTemps());
-            cam_temp_update_time = end;
+        // Camera internal temperatures are read in background by
+        // img_stream; pass them on when new values arrive.
+        if (webserver) {
+            auto cct = is.getCameraComponentTemps();
+            if (cct != cam_temps)
+                webserver->update_temps(cct, cam);
+            cam_temps = cct;
         }
 
         double process_time_us = duration_us(begin, end);
-        if (args.display_delay_us > process_time_us)
+        if (have_frame && !args.batch && args.display_delay_us > process_time_us)
             usleep(args.display_delay_us - process_time_us);
     }
 
+    output_pending(0);
+    cap.stop();
+
+    if (args.batch)
+        st.report(multi ? cam_name + ": " : "", frames, chrono::steady_clock::now() - start_time);
+
     if (gui_available)
         destroyAllWindows();
     if (vw)
@@ -355,24 +498,93 @@ int main(int argc, char **argv)
         exit(0);
     }
 
-    Mat_<double> compenzation_img;
-    if (args.compenzation_img.size() > 0) {
-        compenzation_img = cv::imread(args.compenzation_img, IMREAD_UNCHANGED);
-        compenzation_img -= mean(compenzation_img);
+    unsigned n_cams = args.cameras.size();
+    if (n_cams > 1 && gui_available) {
+        warnx("GUI is not supported with multiple cameras");
+        gui_available = false;
+    }
+
+    tracking_params tp;
+    switch (args.matcher) {
+    case cmd_arguments::matcher::flann:
+        break;
+    case cmd_arguments::matcher::hamming:
+        tp.matcher = matcher_type::hamming;
+        break;
+    case cmd_arguments::matcher::lsh:
+        tp.matcher = matcher_type::lsh;
+        break;
     }
+    tp.budget_ms = args.track_budget_ms;
+    tp.klt_interval = args.klt_interval;
+
+    vector<unique_ptr<img_stream>> streams;
+    vector<thermo_img> refs(n_cams), currs;
+    vector<string> poi_paths;
+    for (unsigned i = 0; i < n_cams; i++) {
+        const cmd_arguments::camera &cam = args.cameras[i];
+
+        Mat_<double> compenzation_img;
+        if (cam.compenzation_img.size() > 0) {
+            compenzation_img = cv::imread(cam.compenzation_img, IMREAD_UNCHANGED);
+            compenzation_img -= mean(compenzation_img);
+        }
 
-    img_stream is(args.vid_in_path, args.license_file);
-    thermo_img ref, curr(compenzation_img);
-    setRefStatus(ref, is, args.poi_import_path, args.tracking != cmd_arguments::tracking::off,
-                 args.heat_sources_border_points);
+        unique_ptr<synthetic_camera::params> synthetic;
+        if (cam.synthetic)
+            synthetic.reset(new synthetic_camera::params(synthetic_camera::params::parse(cam.synthetic_opts)));
+
+        streams.emplace_back(new img_stream(cam.vid_in_path, cam.license_file, synthetic.get()));
+        img_stream &is = *streams.back();
+        if (cam.seek)
+            is.seek(cam.seek);
+        hs_config hs_cfg;
+        switch (args.hs_precision) {
+        case cmd_arguments::hs_precision::float64:
+            break;
+        case cmd_arguments::hs_precision::float32:
+            hs_cfg.prec = hs_config::precision::float32;
+            break;
+        case cmd_arguments::hs_precision::check:
+            hs_cfg.prec = hs_config::precision::check;
+            break;
+        }
+        if (!args.hs_alphas.empty())
+            hs_cfg.alphas = args.hs_alphas;
+        if (!args.hs_img_alphas.empty())
+            hs_cfg.hs_alphas = args.hs_img_alphas;
+        hs_cfg.mean_window = args.hs_mean_window;
+        hs_cfg.stddev_window = args.hs_stddev_window;
+        currs.emplace_back(compenzation_img, hs_cfg);
+        setRefStatus(refs[i], is, cam.poi_import_path, args.tracking != cmd_arguments::tracking::off,
+                     cam.heat_sources_border_points, tp);
+        poi_paths.push_back(cam.poi_import_path);
+    }
+
+    if (args.webserver_active) {
+        webserver = new Webserver(poi_paths, args.mjpeg_port);
+        for (unsigned i = 0; i < n_cams; i++)
+            webserver->set_camera(streams[i]->get_capabilities(), i);
+    }
 
-    if (args.webserver_active)
-        webserver = new Webserver(args.poi_import_path);
+    // Shared by all cameras
+    unique_ptr<thread_pool> pool;
+    if (args.batch)
+        pool.reset(new thread_pool());
 
-    processStream(is, ref, curr, args);
+    if (n_cams == 1) {
+        processStream(*streams[0], refs[0], currs[0], args, 0, pool.get());
+    } else {
+        vector<thread> threads;
+        for (unsigned i = 0; i < n_cams; i++)
+            threads.emplace_back(processStream, ref(*streams[i]), ref(refs[i]), ref(currs[i]),
+                                 cref(args), i, pool.get());
+        for (auto &t : threads)
+            t.join();
+    }
 
     if (!args.poi_export_path.empty())
-        ref.write_poi_json(args.poi_export_path, true);
+        refs[0].write_poi_json(args.poi_export_path, true);
 
     if (webserver)
         webserver->terminate();
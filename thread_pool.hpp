@@ -0,0 +1,74 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads executing submitted jobs in FIFO order.
+class thread_pool {
+public:
+    explicit thread_pool(unsigned n_threads = std::max(1U, std::thread::hardware_concurrency()))
+    {
+        for (unsigned i = 0; i < n_threads; i++)
+            workers.emplace_back(&thread_pool::run, this);
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    unsigned size() const { return workers.size(); }
+
+    template <typename F>
+    auto submit(F &&f) -> std::future<decltype(f())>
+    {
+        using R = decltype(f());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        std::future<R> res = task->get_future();
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            jobs.emplace_back([task]() { (*task)(); });
+        }
+        cv.notify_one();
+        return res;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void run()
+    {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                cv.wait(lk, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+#endif // THREAD_POOL_HPP
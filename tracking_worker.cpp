@@ -0,0 +1,60 @@
+#include "tracking_worker.hpp"
+
+using namespace std;
+
+tracking_worker::tracking_worker(shared_ptr<point_tracker> ref)
+    : ft(move(ref))
+    , thread(&tracking_worker::run, this)
+{
+}
+
+tracking_worker::~tracking_worker()
+{
+    {
+        lock_guard<mutex> lk(mtx);
+        stop = true;
+    }
+    cond.notify_all();
+    thread.join();
+}
+
+void tracking_worker::post(const cv::Mat &gray, chrono::system_clock::time_point time)
+{
+    {
+        lock_guard<mutex> lk(mtx);
+        mailbox = gray;
+        mailbox_time = time;
+    }
+    cond.notify_all();
+}
+
+void tracking_worker::wait_idle()
+{
+    unique_lock<mutex> lk(mtx);
+    cond.wait(lk, [this] { return stop || (mailbox.empty() && !busy); });
+}
+
+void tracking_worker::run()
+{
+    unsigned long seq = 0;
+    unique_lock<mutex> lk(mtx);
+    while (true) {
+        cond.wait(lk, [this] { return stop || !mailbox.empty(); });
+        if (stop)
+            break;
+        cv::Mat gray;
+        swap(gray, mailbox);
+        auto r = make_shared<result>();
+        r->time = mailbox_time;
+        r->seq = ++seq;
+        busy = true;
+        lk.unlock();
+
+        r->H = ft.track(gray, &r->stats);
+        atomic_store(&res, shared_ptr<const result>(move(r)));
+
+        lk.lock();
+        busy = false;
+        cond.notify_all();
+    }
+}
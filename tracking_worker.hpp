@@ -0,0 +1,58 @@
+#ifndef TRACKING_WORKER_HPP
+#define TRACKING_WORKER_HPP
+
+#include "point-tracking.hpp"
+#include <opencv2/core/mat.hpp>
+#include <opencv2/core/types.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Long-lived thread for background point tracking
+// (thermo_img::tracking::async). Frames are passed through a
+// single-slot mailbox: a frame posted while the worker is busy
+// replaces the waiting one, so the worker always tracks the newest
+// frame and the caller never blocks. Results are published atomically
+// and can be read at any time without waiting.
+class tracking_worker {
+public:
+    struct result {
+        cv::Mat H;              // Homography from the reference image; empty if not found
+        homography_stats stats;
+        std::chrono::system_clock::time_point time; // Of the tracked frame
+        unsigned long seq = 0;  // Increments with each result
+    };
+
+    // ref is used only by the worker thread (see frame_tracker)
+    explicit tracking_worker(std::shared_ptr<point_tracker> ref);
+    ~tracking_worker();
+
+    // gray must not be modified later (the worker keeps a reference)
+    void post(const cv::Mat &gray, std::chrono::system_clock::time_point time);
+
+    // Latest result or nullptr
+    std::shared_ptr<const result> latest() const { return std::atomic_load(&res); }
+
+    // Wait until all posted frames are processed
+    void wait_idle();
+
+private:
+    frame_tracker ft;
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    cv::Mat mailbox;            // Frame waiting for the worker
+    std::chrono::system_clock::time_point mailbox_time;
+    bool busy = false;
+    bool stop = false;
+
+    std::shared_ptr<const result> res;
+    std::thread thread;
+
+    void run();
+};
+
+#endif // TRACKING_WORKER_HPP
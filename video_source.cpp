@@ -0,0 +1,60 @@
+#include "video_source.hpp"
+#include "frame_pool.hpp"
+#include <opencv2/imgproc.hpp>
+#include <unistd.h>
+
+using namespace cv;
+using namespace std;
+
+video_source::video_source(const string &path)
+{
+    if (access(path.c_str(), F_OK) == -1) // File does not exist
+        throw runtime_error("Video open: " + path);
+    video.open(path);
+
+    caps.backend = "video";
+    caps.width = video.get(CAP_PROP_FRAME_WIDTH);
+    caps.height = video.get(CAP_PROP_FRAME_HEIGHT);
+    caps.fps = video.get(CAP_PROP_FPS);
+    caps.formats = { pixel_format::bgr8 };
+    caps.seekable = true;
+
+    set_lut([](uint16_t raw) {
+        return RECORD_MIN_C + (RECORD_MAX_C - RECORD_MIN_C) * double(raw - min_raw) / (max_raw - min_raw);
+    });
+}
+
+camera_source::capabilities video_source::get_capabilities() const
+{
+    return caps;
+}
+
+bool video_source::get_image(Mat_<uint16_t> &result, chrono::system_clock::time_point &time)
+{
+    time = chrono::system_clock::now();
+    video >> frame;
+    if (frame.empty()) {
+        if (!loop)
+            return false;
+        // loop to start
+        video.set(CAP_PROP_POS_FRAMES, 0);
+        video >> frame;
+    }
+    if (frame.channels() == 1)
+        gray = frame;
+    else
+        cvtColor(frame, gray, COLOR_RGB2GRAY);
+    frame_pool::instance().create(result, gray.rows, gray.cols);
+    gray.convertTo(result, CV_16U, (max_raw - min_raw) / 256.0, min_raw);
+    return true;
+}
+
+uint16_t video_source::celsius_to_raw(double celsius) const
+{
+    return saturate_cast<uint16_t>(min_raw + (celsius - RECORD_MIN_C) * (max_raw - min_raw) / (RECORD_MAX_C - RECORD_MIN_C));
+}
+
+void video_source::seek(size_t frame)
+{
+    video.set(CAP_PROP_POS_FRAMES, frame);
+}
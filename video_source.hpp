@@ -0,0 +1,32 @@
+#ifndef VIDEO_SOURCE_HPP
+#define VIDEO_SOURCE_HPP
+
+#include "camera_source.hpp"
+#include <opencv2/videoio.hpp>
+
+// 8-bit video (e.g. recorded with -r) read by OpenCV. Gray levels
+// 0-255 correspond to temperatures RECORD_MIN_C-RECORD_MAX_C.
+class video_source : public camera_source {
+public:
+    explicit video_source(const std::string &path);
+
+    capabilities get_capabilities() const override;
+    bool get_image(cv::Mat_<uint16_t> &result, std::chrono::system_clock::time_point &time) override;
+    uint16_t celsius_to_raw(double celsius) const override;
+    void seek(size_t frame) override;
+
+private:
+    // The same raw values as those returned by our camera for
+    // RECORD_MIN_C and RECORD_MAX_C
+    static constexpr uint16_t min_raw = 7231;
+    static constexpr uint16_t max_raw = 9799;
+
+    cv::VideoCapture video;
+    // Read once in the constructor: VideoCapture is not thread-safe
+    // and get_capabilities() is called from other threads than
+    // get_image().
+    capabilities caps;
+    cv::Mat frame, gray; // Members to avoid allocations
+};
+
+#endif // VIDEO_SOURCE_HPP
@@ -6,26 +6,28 @@
 #include "index.html.hpp"
 #include "script.js.hpp"
 #include <filesystem>
+#include <cmath>
+#include <algorithm>
 
 
 using namespace std;
 namespace fs = std::filesystem;
 using json = nlohmann::json;
 
-void sendPOITemp(crow::response &res, std::vector<POI> poi)
+void sendPOITemp(crow::response &res, const std::vector<POI> &poi)
 {
     std::stringstream ss; 
-    for (auto p : poi)
+    for (const auto &p : poi)
         ss << p.name << "=" << std::fixed << std::setprecision(2) << p.temp << "\n";
 
     res.write(ss.str());
 }
 
-void sendHeatSources(crow::response &res, std::vector<HeatSource> poi)
+void sendHeatSources(crow::response &res, const std::vector<HeatSource> &poi)
 {
     std::stringstream ss;
     ss << "heat_sources=";
-    for (auto p : poi)
+    for (const auto &p : poi)
         ss << p.location.x << "," << p.location.y << "," <<
               std::fixed << std::setprecision(2) << p.neg_laplacian << ";";
     std::string s = ss.str();
@@ -35,19 +37,21 @@ void sendHeatSources(crow::response &res, std::vector<HeatSource> poi)
     res.write(s);
 }
 
-void sendCameraComponentTemps(crow::response &res, std::vector<std::pair<std::string, double>> cameraComponentTemps)
+void sendCameraComponentTemps(crow::response &res, std::shared_ptr<const camera_temps> cameraComponentTemps)
 {
+    if (!cameraComponentTemps)
+        return;
     std::stringstream ss;
-    for (auto el : cameraComponentTemps)
+    for (auto el : cameraComponentTemps->values)
         ss << el.first  << "=" << std::fixed << std::setprecision(2) << el.second << "\n";
 
     res.write(ss.str());
 }
 
-void sendPOIPosStd(crow::response &res, std::vector<POI> poi)
+void sendPOIPosStd(crow::response &res, const std::vector<POI> &poi)
 {
     std::stringstream ss;
-    for (auto p : poi)
+    for (const auto &p : poi)
         ss << p.name << "=" << std::fixed << std::setprecision(4) << p.rolling_std << "\n";
 
     res.write(ss.str());
@@ -61,47 +65,125 @@ std::string get_poi_name(const std::string &poi_path)
     return p.stem();
 }
 
-Webserver::Webserver(const std::string &poi_path)
-    : poi_name(get_poi_name(poi_path))
-    , web_thread(&Webserver::start, this)
-{}
+Webserver::Webserver(const std::vector<std::string> &poi_paths, unsigned short mjpeg_port)
+    : mjpeg_port(mjpeg_port)
+{
+    for (const std::string &poi_path : poi_paths) {
+        cams.emplace_back(new camera);
+        cams.back()->poi_name = get_poi_name(poi_path);
+    }
+    mjpeg_start(); // Before the routes use mjpeg_acceptor
+    web_thread = std::thread(&Webserver::start, this);
+    bcast_thread = std::thread(&Webserver::broadcast_loop, this);
+}
 
 void Webserver::terminate()
 {
     if (!finished)
         pthread_kill(web_thread.native_handle(), SIGINT);
     web_thread.join();
+    {
+        std::lock_guard<std::mutex> lk(bcast_mtx);
+        bcast_stop = true;
+    }
+    bcast_cv.notify_one();
+    bcast_thread.join();
+    mjpeg_io.stop();
+    if (mjpeg_thread.joinable())
+        mjpeg_thread.join();
+    mjpeg_pool.reset();
 }
 
-void Webserver::update(const thermo_img &ti)
+void Webserver::update(const thermo_img &ti, unsigned cam)
 {
+    camera &c = *cams.at(cam);
+    std::shared_ptr<frame_snapshot> snap(new frame_snapshot { ++c.frame_cnt, ti });
+    snap->ti.stamp(frame_stamps::webserver);
+    // Readers keep using the previous snapshot until they finish
+    std::atomic_store(&c.snap, std::shared_ptr<const frame_snapshot>(snap));
     {
-        std::lock_guard<std::mutex> lk(lock);
-        this->ti = ti;
-        frame_cnt++;
+        // Frames not broadcast yet are replaced by the newer one
+        std::lock_guard<std::mutex> lk(bcast_mtx);
+        c.bcast_snap = snap;
+    }
+    bcast_cv.notify_one();
+    if (mjpeg_streams)
+        mjpeg_io.post([this] { mjpeg_frame(); });
+}
+
+// Send updates to websocket clients, so that slow clients or network
+// do not delay frame processing
+void Webserver::broadcast_loop()
+{
+    std::unique_lock<std::mutex> lk(bcast_mtx);
+    while (true) {
+        bcast_cv.wait(lk, [this] {
+            return bcast_stop || any_of(cams.begin(), cams.end(), [](auto &c) { return bool(c->bcast_snap); });
+        });
+        if (bcast_stop)
+            break;
+        for (auto &c : cams) {
+            std::shared_ptr<const frame_snapshot> snap = std::move(c->bcast_snap);
+            if (!snap)
+                continue;
+            lk.unlock();
+            broadcast(*c, snap);
+
+            frame_stamps fs = snap->ti.get_stamps();
+            fs.stamp(frame_stamps::broadcast);
+            for (int s = frame_stamps::update; s < frame_stamps::count; s++)
+                c->stage_latency[s].add(fs.stage_latency(frame_stamps::stage(s)));
+            c->frame_latency.add(fs.latency(frame_stamps::broadcast));
+            lk.lock();
+        }
     }
-    noticeClients();
 }
 
-void Webserver::update_temps(const std::vector<std::pair<string, double> > &cct)
+void Webserver::update_temps(std::shared_ptr<const camera_temps> cct, unsigned cam)
 {
-    std::lock_guard<std::mutex> lk(lock);
-    this->cameraComponentTemps = cct;
+    camera &c = *cams.at(cam);
+    std::lock_guard<std::mutex> lk(c.lock);
+    c.cameraComponentTemps = std::move(cct);
+}
+
+void Webserver::update_capture_stats(const capture::stats &cs, unsigned cam)
+{
+    camera &c = *cams.at(cam);
+    std::lock_guard<std::mutex> lk(c.lock);
+    c.capture_stats = cs;
+}
+
+void Webserver::set_camera(const camera_source::capabilities &caps, unsigned cam)
+{
+    camera &c = *cams.at(cam);
+    std::lock_guard<std::mutex> lk(c.lock);
+    c.caps = caps;
+}
+
+size_t Webserver::users_count()
+{
+    size_t n = 0;
+    for (auto &c : cams) {
+        std::lock_guard<std::mutex> _(c->usr_mtx);
+        n += c->users.size();
+    }
+    return n;
 }
 
 void to_json(json& j, const HeatSource& p) {
     j = json::array({p.location.x, p.location.y, int(p.neg_laplacian * 1000)/1000.0});
 }
 
-// Called from update() - no need to lock this->lock
-void Webserver::noticeClients() {
+std::string Webserver::update_message(const frame_snapshot &snap)
+{
+    const thermo_img &ti = snap.ti;
     json msg;
     json msg_lwi = json::array();
     msg["type"] = "update";
     for (const auto &lwi : ti.get_webimgs()) {
         json msg_wi = json::array();
         for (const auto& wi : lwi)
-            msg_wi.push_back({{"name", wi.name}, {"title", wi.title}, {"desc", wi.html_desc}});
+            msg_wi.push_back({{"name", wi.name}, {"title", wi.title}, {"desc", wi.html_desc()}});
         msg_lwi.push_back(msg_wi);
     }
     msg["imgs"] = msg_lwi;
@@ -116,47 +198,488 @@ void Webserver::noticeClients() {
     }
     msg["poi_temp"] = msg_pt;
 
-    std::lock_guard<std::mutex> _(this->usr_mtx);
-    std::string msg_str = msg.dump();
-    for(crow::websocket::connection* u : this->users) {
-        u->send_text(msg_str);
+    const homography_stats &ts = ti.get_track_stats();
+    msg["tracking"] = { {"matches", ts.matches}, {"inliers", ts.inliers}, {"iterations", ts.iterations},
+                        {"warm_start", ts.warm_start}, {"klt", ts.klt}, {"time_ms", int(ts.time_ms * 1000) / 1000.0} };
+
+    return msg.dump();
+}
+
+void Webserver::broadcast(camera &c, const std::shared_ptr<const frame_snapshot> &snap)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::vector<stream_send> streams;
+
+    std::unique_lock<std::mutex> lk(c.usr_mtx);
+    for (auto &[conn, cl] : c.users) {
+        if (cl.closing)
+            continue;
+        if (!cl.acks) {
+            if (cl.inflight < ws_client::max_unacked) {
+                send_update(c, *conn, cl, snap, streams);
+            } else {
+                std::cerr << "Closing websocket client " << cl.id << ": " << cl.inflight
+                          << " updates without acknowledgment" << std::endl;
+                cl.closing = true;
+                c.ws_closed_slow++;
+                conn->close("No acknowledgment");
+            }
+            continue;
+        }
+        if (cl.inflight < ws_client::max_inflight) {
+            send_update(c, *conn, cl, snap, streams);
+            continue;
+        }
+        // The client has not processed the previous updates yet
+        if (cl.pending)
+            cl.dropped++;
+        cl.pending = snap;
+        if (now - cl.last_ack > ws_client::timeout) {
+            std::cerr << "Closing websocket client " << cl.id << ": no acknowledgment for "
+                      << std::chrono::duration_cast<std::chrono::seconds>(now - cl.last_ack).count() << " s" << std::endl;
+            cl.closing = true;
+            c.ws_closed_slow++;
+            conn->close("Too slow");
+        }
     }
+    lk.unlock();
+    send_streams(c, streams);
 }
 
-crow::response Webserver::send_img(const cv::Mat &img, const std::string &ext)
+// Send the frame to the client in its format. JSON messages are
+// created only once per frame. /stream messages are only queued to
+// streams, for send_streams() after unlocking. Called with c.usr_mtx
+// locked.
+void Webserver::send_update(camera &c, crow::websocket::connection &conn, ws_client &cl,
+                            const std::shared_ptr<const frame_snapshot> &snap, std::vector<stream_send> &streams)
 {
-    lock.lock();
-    cv::Mat curr_img = img;
-    lock.unlock();
+    if (cl.stream) {
+        streams.push_back({ &conn, cl.stream, snap });
+    } else {
+        if (c.msg_frame != snap->frame) {
+            c.msg = update_message(*snap);
+            c.msg_frame = snap->frame;
+        }
+        conn.send_text(c.msg);
+    }
+    cl.inflight++;
+}
 
-    crow::response res;
-    res.add_header("Cache-Control", "no-store");        // Images should always be fresh.
+// Shared part of /stream messages of the frame
+std::shared_ptr<const frame_stream_frame> Webserver::stream_frame(camera &c, const frame_snapshot &snap)
+{
+    std::lock_guard<std::mutex> lk(c.stream_mtx);
+    if (c.stream_frame && c.stream_frame->frame == snap.frame)
+        return c.stream_frame;
+    const thermo_img &ti = snap.ti;
+    auto f = frame_stream_encoder::prepare(snap.frame, ti.get_time(), ti.get_celsius(), ti.get_heat_sources_border(),
+                                           ti.get_poi(), ti.get_heat_sources(), ti.get_heat_sources_in_frame());
+    if (!c.stream_frame || c.stream_frame->frame < snap.frame)
+        c.stream_frame = f;
+    return f;
+}
+
+// Encode and send the /stream messages queued by send_update(). Only
+// delta frames are encoded per client; this runs without c.usr_mtx,
+// so it does not block other clients.
+void Webserver::send_streams(camera &c, const std::vector<stream_send> &streams)
+{
+    for (const stream_send &s : streams) {
+        std::shared_ptr<const frame_stream_frame> f = stream_frame(c, *s.snap);
+        std::lock_guard<std::mutex> lk(s.stream->mtx);
+        std::string msg;
+        // A newer frame may have been sent after an acknowledgment
+        if (s.snap->frame > s.stream->frame)
+            msg = s.stream->enc.encode(*f);
+
+        std::lock_guard<std::mutex> _(c.usr_mtx);
+        auto it = c.users.find(s.conn);
+        if (it == c.users.end() || it->second.stream != s.stream)
+            continue;           // Closed in the meantime
+        ws_client &cl = it->second;
+        if (msg.empty() || cl.closing) {
+            if (cl.inflight > 0)
+                cl.inflight--;
+            continue;
+        }
+        s.conn->send_binary(msg);
+        s.stream->frame = s.snap->frame;
+    }
+}
+
+// Called by crow when the client acknowledges an update message
+void Webserver::acknowledge(camera &c, crow::websocket::connection &conn)
+{
+    std::vector<stream_send> streams;
+    {
+        std::lock_guard<std::mutex> _(c.usr_mtx);
+        auto it = c.users.find(&conn);
+        if (it == c.users.end())
+            return;
+        ws_client &cl = it->second;
+        cl.acks = true;
+        cl.last_ack = std::chrono::steady_clock::now();
+        if (cl.inflight > 0)
+            cl.inflight--;
+        if (cl.pending && !cl.closing) {
+            std::shared_ptr<const frame_snapshot> snap = std::move(cl.pending);
+            send_update(c, conn, cl, snap, streams);
+        }
+    }
+    send_streams(c, streams);
+}
+
+// Strong entity tag: FNV-1a hash of the data
+static std::string etag(const std::string &data)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char ch : data)
+        h = (h ^ ch) * 1099511628211ull;
+    std::stringstream ss;
+    ss << '"' << std::hex << std::setw(16) << std::setfill('0') << h << '"';
+    return ss.str();
+}
+
+std::shared_ptr<const Webserver::encoded_img>
+Webserver::encode(camera &c, unsigned long frame, const std::string &name, const std::string &ext, int quality,
+                  const std::function<cv::Mat()> &get_img)
+{
+    std::vector<int> params;
+    std::string key = name + ext;
+    if (ext == ".jpg") {
+        params = { cv::IMWRITE_JPEG_QUALITY, quality };
+        key += "?quality=" + std::to_string(quality);
+    }
+
+    encode_slot *slot;
+    {
+        std::lock_guard<std::mutex> lk(c.enc_mtx);
+        std::unique_ptr<encode_slot> &s = c.enc_cache[key];
+        if (!s)
+            s.reset(new encode_slot);
+        slot = s.get();
+    }
+
+    // Encode each frame only once, concurrent requests of the same
+    // image wait for the result. A request for an older frame than
+    // the cached one gets its own image, but does not replace the
+    // cache entry.
+    std::lock_guard<std::mutex> lk(slot->mtx);
+    if (slot->img && slot->img->frame == frame)
+        return slot->img;
+    auto e = std::make_shared<encoded_img>();
+    e->frame = frame;
+    cv::Mat img = get_img();
     std::vector<uchar> img_v;
-    cv::imencode(ext, img, img_v);
-    std::string img_s(img_v.begin(), img_v.end());
-    res.write(img_s);
+    if (img.empty() || !cv::imencode(ext, img, img_v, params))
+        return nullptr;
+    e->data.assign(img_v.begin(), img_v.end());
+    e->etag = etag(e->data);
+    if (!slot->img || slot->img->frame < frame)
+        slot->img = e;
+    c.img_encodes++;
+    return e;
+}
+
+crow::response Webserver::send_img(const crow::request &req, camera &c, unsigned long frame,
+                                   const std::string &name, const std::string &ext,
+                                   const std::function<cv::Mat()> &get_img)
+{
+    const char *q = req.url_params.get("quality");
+    int quality = q ? std::clamp(atoi(q), 1, 100) : 95;
+    std::shared_ptr<const encoded_img> enc = encode(c, frame, name, ext, quality, get_img);
+    if (!enc)
+        return crow::response(404);
+
+    crow::response res;
+    res.add_header("Cache-Control", "no-cache"); // Images should always be fresh, revalidate via ETag.
+    res.add_header("ETag", enc->etag);
+    if (req.get_header_value("If-None-Match") == enc->etag) {
+        c.img_not_modified++;
+        res.code = 304;
+        return res;
+    }
+    res.body = enc->data;
     return res;
 }
 
+// MJPEG streams
+//
+// crow cannot send a response in parts, so the streams are served by
+// a minimal HTTP server on mjpeg_port. All its I/O is asynchronous in
+// mjpeg_thread. Each client gets the newest frame after the previous
+// one has been written, so slow clients skip frames instead of
+// queuing them.
+
+static const std::string mjpeg_boundary = "thermocam-frame";
+
+struct Webserver::mjpeg_client {
+    // Limits for reading the request header
+    static constexpr size_t max_request = 8192;
+    static constexpr std::chrono::seconds request_timeout{5};
+
+    explicit mjpeg_client(boost::asio::io_service &io) : sock(io), timer(io), request(max_request) {}
+
+    boost::asio::ip::tcp::socket sock;
+    boost::asio::steady_timer timer;
+    boost::asio::streambuf request;
+    bool requested = false;     // Request header received
+    camera *cam = nullptr;
+    std::string name;           // Image name (without .mjpg)
+    int quality = 95;
+    std::chrono::steady_clock::duration interval {}; // Minimum time between frames (?fps=)
+    std::chrono::steady_clock::time_point next;      // Earliest time of the next frame
+    unsigned long frame = 0;    // Last sent frame
+    bool busy = false;          // Writing or waiting for the timer
+    std::string part_header;
+    std::shared_ptr<const encoded_img> img; // Being written
+};
+
+void Webserver::mjpeg_start()
+{
+    using boost::asio::ip::tcp;
+    if (mjpeg_port == 0)
+        return;
+    try {
+        mjpeg_acceptor = std::make_unique<tcp::acceptor>(mjpeg_io, tcp::endpoint(tcp::v4(), mjpeg_port));
+    } catch (const boost::system::system_error &e) {
+        warnx("MJPEG streams disabled: port %u: %s", mjpeg_port, e.what());
+        return;
+    }
+    mjpeg_pool = std::make_unique<thread_pool>(2);
+    mjpeg_accept();
+    mjpeg_thread = std::thread([this] { mjpeg_io.run(); });
+}
+
+void Webserver::mjpeg_accept()
+{
+    auto cl = std::make_shared<mjpeg_client>(mjpeg_io);
+    mjpeg_acceptor->async_accept(cl->sock, [this, cl](const boost::system::error_code &ec) {
+        if (ec == boost::asio::error::operation_aborted)
+            return;
+        if (!ec) {
+            // Close connections that do not send the header in time
+            cl->timer.expires_from_now(mjpeg_client::request_timeout);
+            cl->timer.async_wait([cl](const boost::system::error_code &ec) {
+                if (!ec && !cl->requested)
+                    cl->sock.close();
+            });
+            boost::asio::async_read_until(cl->sock, cl->request, "\r\n\r\n",
+                                          [this, cl](const boost::system::error_code &ec, size_t) {
+                                              cl->requested = true;
+                                              cl->timer.cancel();
+                                              if (!ec)
+                                                  mjpeg_request(cl);
+                                          });
+        }
+        mjpeg_accept();
+    });
+}
+
+// Start the stream requested as [/camN]/NAME.mjpg[?fps=F&quality=Q]
+void Webserver::mjpeg_request(std::shared_ptr<mjpeg_client> cl)
+{
+    std::istream is(&cl->request);
+    std::string method, target;
+    is >> method >> target;
+    size_t q = target.find('?');
+    std::string path = target.substr(0, q);
+    std::stringstream query(q == std::string::npos ? "" : target.substr(q + 1));
+
+    unsigned cam = 0;
+    if (sscanf(path.c_str(), "/cam%u/", &cam) == 1)
+        path.erase(0, path.find('/', 1));
+    const std::string ext = ".mjpg";
+    bool ok = method == "GET" && cam < cams.size() && path.size() > 1 + ext.size() &&
+        path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+    if (ok) {
+        cl->cam = cams[cam].get();
+        cl->name = path.substr(1, path.size() - 1 - ext.size());
+        std::shared_ptr<const frame_snapshot> snap = cl->cam->snapshot();
+        ok = cl->name == "thermocam-current" || (snap && snap->ti.get_webimg(cl->name));
+    }
+
+    std::string param;
+    while (getline(query, param, '&')) {
+        size_t eq = param.find('=');
+        std::string key = param.substr(0, eq);
+        const char *val = eq == std::string::npos ? "" : param.c_str() + eq + 1;
+        if (key == "fps" && atof(val) > 0)
+            cl->interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(1 / atof(val)));
+        else if (key == "quality")
+            cl->quality = std::clamp(atoi(val), 1, 100);
+    }
+
+    auto hdr = std::make_shared<std::string>(
+        ok ? "HTTP/1.1 200 OK\r\n"
+             "Content-Type: multipart/x-mixed-replace; boundary=" + mjpeg_boundary + "\r\n"
+             "Cache-Control: no-cache\r\n"
+             "Connection: close\r\n\r\n"
+           : "HTTP/1.1 404 Not Found\r\n"
+             "Content-Length: 0\r\n"
+             "Connection: close\r\n\r\n");
+    boost::asio::async_write(cl->sock, boost::asio::buffer(*hdr),
+                             [this, cl, hdr, ok](const boost::system::error_code &ec, size_t) {
+                                 // Otherwise the connection is closed by destroying cl
+                                 if (ec || !ok)
+                                     return;
+                                 mjpeg_clients.push_back(cl);
+                                 mjpeg_streams = mjpeg_clients.size();
+                                 mjpeg_send(cl);
+                             });
+}
+
+// Called (in mjpeg_thread) for every new frame
+void Webserver::mjpeg_frame()
+{
+    mjpeg_clients.erase(remove_if(mjpeg_clients.begin(), mjpeg_clients.end(),
+                                  [](auto &cl) { return !cl->sock.is_open(); }),
+                        mjpeg_clients.end());
+    mjpeg_streams = mjpeg_clients.size();
+    for (auto &cl : mjpeg_clients)
+        mjpeg_send(cl);
+}
+
+// Redirect to the stream on mjpeg_port of the same host. The stream
+// is served only over plain HTTP.
+crow::response Webserver::mjpeg_redirect(const crow::request &req, const std::string &path)
+{
+    if (!mjpeg_acceptor)
+        return crow::response(404);
+    std::string host = req.get_header_value("Host");
+    size_t colon = host.rfind(':');
+    if (colon != std::string::npos && host.find(']', colon) == std::string::npos)
+        host.erase(colon); // Not a part of an IPv6 address
+    std::string url = req.raw_url;
+    size_t q = url.find('?');
+    crow::response res(307);
+    res.set_header("Location", "http://" + host + ":" + std::to_string(mjpeg_port) + path +
+                   (q == std::string::npos ? "" : url.substr(q)));
+    return res;
+}
+
+// Send the newest frame unless the client has it already or is still
+// busy with the previous one
+void Webserver::mjpeg_send(std::shared_ptr<mjpeg_client> cl)
+{
+    if (cl->busy || !cl->sock.is_open())
+        return;
+    camera &c = *cl->cam;
+    std::shared_ptr<const frame_snapshot> snap = c.snapshot();
+    if (!snap || snap->frame <= cl->frame)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now < cl->next) {
+        cl->busy = true;
+        cl->timer.expires_at(cl->next);
+        cl->timer.async_wait([this, cl](const boost::system::error_code &ec) {
+            cl->busy = false;
+            if (!ec)
+                mjpeg_send(cl);
+        });
+        return;
+    }
+
+    const thermo_img::webimg *wi = nullptr;
+    if (cl->name != "thermocam-current") {
+        wi = snap->ti.get_webimg(cl->name);
+        if (!wi) {
+            cl->sock.close();
+            return;
+        }
+        std::lock_guard<std::mutex> lk(c.lock);
+        c.webimg_requests[cl->name]++;
+    }
+    cl->frame = snap->frame;
+    cl->next = now + cl->interval;
+    cl->busy = true;
+    // Clients of the same image share the encoding (see encode())
+    mjpeg_pool->submit([this, cl, snap, wi]() {
+        std::shared_ptr<const encoded_img> img =
+            encode(*cl->cam, snap->frame, cl->name, ".jpg", cl->quality,
+                   [&]() { return wi ? wi->rgb() : snap->ti.get_preview(); });
+        mjpeg_io.post([this, cl, img]() { mjpeg_write(cl, img); });
+    });
+}
+
+// Write the encoded frame to the client (in mjpeg_thread)
+void Webserver::mjpeg_write(std::shared_ptr<mjpeg_client> cl, std::shared_ptr<const encoded_img> img)
+{
+    cl->busy = false;
+    if (!img || !cl->sock.is_open())
+        return;
+    cl->img = img;
+
+    static const std::string crlf = "\r\n";
+    cl->part_header = "--" + mjpeg_boundary + "\r\n"
+        "Content-Type: image/jpeg\r\n"
+        "Content-Length: " + std::to_string(cl->img->data.size()) + "\r\n\r\n";
+    std::array<boost::asio::const_buffer, 3> bufs = {
+        boost::asio::buffer(cl->part_header),
+        boost::asio::buffer(cl->img->data),
+        boost::asio::buffer(crlf),
+    };
+    cl->busy = true;
+    boost::asio::async_write(cl->sock, bufs, [this, cl](const boost::system::error_code &ec, size_t) {
+        cl->busy = false;
+        cl->img.reset();
+        if (ec) {
+            cl->sock.close();
+            return;
+        }
+        // A newer frame may have arrived in the meantime
+        mjpeg_send(cl);
+    });
+}
+
 std::string Webserver::prometheus_metics()
 {
-    this->lock.lock();
-    std::vector<POI> curr_poi = ti.get_poi();
-    std::vector<std::pair<std::string,double>> curr_cct = this->cameraComponentTemps;
-    this->lock.unlock();
+    static const char *formats[] = { "raw16", "gray8", "bgr8" };
+
+    struct snapshot {
+        std::string label;      // Prometheus label identifying the camera
+        std::string poi_name;
+        std::vector<POI> poi;
+        std::shared_ptr<const camera_temps> cct;
+        capture::stats cs;
+        camera_source::capabilities caps;
+        unsigned long frame_cnt;
+        std::vector<std::pair<std::string, size_t>> hs_memory;
+        std::map<std::string, unsigned long> webimg_requests;
+        homography_stats track;
+    };
+    std::vector<snapshot> snaps;
+    for (unsigned i = 0; i < cams.size(); i++) {
+        camera &c = *cams[i];
+        std::shared_ptr<const frame_snapshot> curr = c.snapshot();
+        std::lock_guard<std::mutex> lk(c.lock);
+        snaps.push_back({ "camera=\"" + std::to_string(i) + "\"", c.poi_name,
+                          curr ? curr->ti.get_poi() : std::vector<POI>(),
+                          c.cameraComponentTemps, c.capture_stats, c.caps, curr ? curr->frame : 0,
+                          curr ? curr->ti.get_hs_memory() : std::vector<std::pair<std::string, size_t>>(),
+                          c.webimg_requests, curr ? curr->ti.get_track_stats() : homography_stats() });
+    }
 
     std::stringstream ss;
     ss << "# TYPE thermocam_point_temp gauge\n";
-    for (auto p : curr_poi)
-        ss << "thermocam_point_temp{name=\""<< poi_name <<"\", point=\""<< p.name <<"\"} " << std::fixed << std::setprecision(2) << p.temp << "\n";
+    for (auto &s : snaps)
+        for (auto p : s.poi)
+            ss << "thermocam_point_temp{" << s.label << ", name=\""<< s.poi_name <<"\", point=\""<< p.name <<"\"} " << std::fixed << std::setprecision(2) << p.temp << "\n";
 
     ss << "# TYPE thermocam_point_pos_stddev gauge\n";
-    for (auto p : curr_poi)
-        ss << "thermocam_point_pos_stddev{name=\""<< poi_name <<"\", point=\""<< p.name <<"\"} " << std::fixed << std::setprecision(4) << p.rolling_std << "\n";
+    for (auto &s : snaps)
+        for (auto p : s.poi)
+            ss << "thermocam_point_pos_stddev{" << s.label << ", name=\""<< s.poi_name <<"\", point=\""<< p.name <<"\"} " << std::fixed << std::setprecision(4) << p.rolling_std << "\n";
 
     ss << "# TYPE thermocam_temp gauge\n";
-    for (auto el : cameraComponentTemps)
-        ss << "thermocam_temp{component=\""<< el.first <<"\"} " << std::fixed << std::setprecision(2) << el.second << "\n";
+    for (auto &s : snaps) {
+        if (!s.cct)
+            continue;
+        for (auto el : s.cct->values)
+            ss << "thermocam_temp{" << s.label << ", component=\""<< el.first <<"\"} " << std::fixed << std::setprecision(2) << el.second << "\n";
+    }
 
     {
         using namespace std::chrono;
@@ -166,90 +689,305 @@ std::string Webserver::prometheus_metics()
     }
 
     ss << "# TYPE thermocam_frame counter\n";
-    ss << "thermocam_frame " << frame_cnt << "\n";
+    for (auto &s : snaps)
+        ss << "thermocam_frame{" << s.label << "} " << s.frame_cnt << "\n";
+
+    ss << "# TYPE thermocam_img_encodes counter\n";
+    for (unsigned i = 0; i < cams.size(); i++)
+        ss << "thermocam_img_encodes{" << snaps[i].label << "} " << cams[i]->img_encodes << "\n";
+
+    ss << "# TYPE thermocam_img_not_modified counter\n";
+    for (unsigned i = 0; i < cams.size(); i++)
+        ss << "thermocam_img_not_modified{" << snaps[i].label << "} " << cams[i]->img_not_modified << "\n";
+
+    ss << "# TYPE thermocam_webimg_requests counter\n";
+    for (auto &s : snaps)
+        for (auto &r : s.webimg_requests)
+            ss << "thermocam_webimg_requests{" << s.label << ", image=\"" << r.first << "\"} " << r.second << "\n";
+
+    ss << "# TYPE thermocam_hs_stats_bytes gauge\n";
+    for (auto &s : snaps)
+        for (auto &m : s.hs_memory)
+            ss << "thermocam_hs_stats_bytes{" << s.label << ", image=\"" << m.first << "\"} " << m.second << "\n";
+
+    // Last tracking result (see --track-budget)
+    ss << "# TYPE thermocam_tracking_matches gauge\n";
+    for (auto &s : snaps)
+        ss << "thermocam_tracking_matches{" << s.label << "} " << s.track.matches << "\n";
+    ss << "# TYPE thermocam_tracking_inliers gauge\n";
+    for (auto &s : snaps)
+        ss << "thermocam_tracking_inliers{" << s.label << "} " << s.track.inliers << "\n";
+    ss << "# TYPE thermocam_tracking_iterations gauge\n";
+    for (auto &s : snaps)
+        ss << "thermocam_tracking_iterations{" << s.label << "} " << s.track.iterations << "\n";
+    ss << "# TYPE thermocam_tracking_warm_start gauge\n";
+    for (auto &s : snaps)
+        ss << "thermocam_tracking_warm_start{" << s.label << "} " << s.track.warm_start << "\n";
+    ss << "# TYPE thermocam_tracking_klt gauge\n";
+    for (auto &s : snaps)
+        ss << "thermocam_tracking_klt{" << s.label << "} " << s.track.klt << "\n";
+    ss << "# TYPE thermocam_tracking_seconds gauge\n";
+    for (auto &s : snaps)
+        ss << "thermocam_tracking_seconds{" << s.label << "} " << std::fixed << std::setprecision(6) << s.track.time_ms / 1000 << "\n";
+
+    // Quantiles of recent latencies, sum and count of all of them
+    auto latency_summary = [&ss](const std::string &name, const std::string &labels, const latency_histogram &h) {
+        static const char *quantiles[] = { "0.5", "0.95", "0.99" };
+        for (const char *q : quantiles) {
+            double v = h.quantile(atof(q));
+            ss << name << "{" << labels << ", quantile=\"" << q << "\"} ";
+            if (std::isnan(v))
+                ss << "NaN\n";
+            else
+                ss << std::fixed << std::setprecision(6) << v << "\n";
+        }
+        ss << name << "_sum{" << labels << "} " << std::fixed << std::setprecision(6) << h.sum() << "\n";
+        ss << name << "_count{" << labels << "} " << h.count() << "\n";
+    };
+
+    ss << "# TYPE thermocam_frame_latency_seconds summary\n";
+    for (unsigned i = 0; i < cams.size(); i++)
+        latency_summary("thermocam_frame_latency_seconds", snaps[i].label, cams[i]->frame_latency);
+
+    ss << "# TYPE thermocam_stage_latency_seconds summary\n";
+    for (unsigned i = 0; i < cams.size(); i++)
+        for (int s = frame_stamps::update; s < frame_stamps::count; s++)
+            latency_summary("thermocam_stage_latency_seconds",
+                            snaps[i].label + ", stage=\"" + frame_stamps::names[s] + "\"",
+                            cams[i]->stage_latency[s]);
+
+    ss << "# TYPE thermocam_capture_frames counter\n";
+    for (auto &s : snaps)
+        ss << "thermocam_capture_frames{" << s.label << "} " << s.cs.captured << "\n";
+
+    ss << "# TYPE thermocam_capture_overruns counter\n";
+    for (auto &s : snaps)
+        ss << "thermocam_capture_overruns{" << s.label << "} " << s.cs.overruns << "\n";
+
+    ss << "# TYPE thermocam_capture_skipped counter\n";
+    for (auto &s : snaps)
+        ss << "thermocam_capture_skipped{" << s.label << "} " << s.cs.skipped << "\n";
+
+    // The pool is shared by all cameras
+    frame_pool::stats ps = snaps[0].cs.pool;
+
+    ss << "# TYPE thermocam_frame_pool_allocations counter\n";
+    ss << "thermocam_frame_pool_allocations " << ps.allocations << "\n";
+
+    ss << "# TYPE thermocam_frame_pool_reuses counter\n";
+    ss << "thermocam_frame_pool_reuses " << ps.reuses << "\n";
+
+    ss << "# TYPE thermocam_frame_pool_free gauge\n";
+    ss << "thermocam_frame_pool_free " << ps.free << "\n";
+
+    ss << "# TYPE thermocam_camera_info gauge\n";
+    for (auto &s : snaps)
+        ss << "thermocam_camera_info{" << s.label << ", backend=\"" << s.caps.backend
+           << "\", format=\"" << (s.caps.formats.empty() ? "" : formats[int(s.caps.formats[0])])
+           << "\", width=\"" << s.caps.width << "\", height=\"" << s.caps.height
+           << "\", zero_copy=\"" << s.caps.zero_copy << "\"} 1\n";
+
+    ss << "# TYPE thermocam_camera_fps gauge\n";
+    for (auto &s : snaps)
+        ss << "thermocam_camera_fps{" << s.label << "} " << std::fixed << std::setprecision(2) << s.caps.fps << "\n";
 
     ss << "# TYPE thermocam_users gauge\n";
-    ss << "thermocam_users " << users.size() << "\n";
+    ss << "thermocam_users " << users_count() << "\n";
+
+    // Per websocket client: unacknowledged and pending updates, and
+    // updates replaced by newer ones before sending
+    std::stringstream queue, dropped;
+    for (unsigned i = 0; i < cams.size(); i++) {
+        camera &c = *cams[i];
+        std::lock_guard<std::mutex> _(c.usr_mtx);
+        for (auto &[conn, cl] : c.users) {
+            std::string labels = snaps[i].label + ", client=\"" + std::to_string(cl.id) + "\"";
+            queue << "thermocam_ws_client_queue{" << labels << "} " << cl.inflight + (cl.pending ? 1 : 0) << "\n";
+            dropped << "thermocam_ws_client_dropped{" << labels << "} " << cl.dropped << "\n";
+        }
+    }
+    ss << "# TYPE thermocam_ws_client_queue gauge\n" << queue.str();
+    ss << "# TYPE thermocam_ws_client_dropped counter\n" << dropped.str();
+
+    ss << "# TYPE thermocam_mjpeg_streams gauge\n";
+    ss << "thermocam_mjpeg_streams " << mjpeg_streams << "\n";
+
+    ss << "# TYPE thermocam_ws_closed_slow counter\n";
+    for (unsigned i = 0; i < cams.size(); i++)
+        ss << "thermocam_ws_closed_slow{" << snaps[i].label << "} " << cams[i]->ws_closed_slow << "\n";
 
     return ss.str();
 }
 
-void Webserver::start()
+// Routes showing data of one camera
+void Webserver::add_websocket_route(const std::string &url, camera &c, bool stream)
 {
-    crow::mustache::set_base(".");
-    app.loglevel(crow::LogLevel::Warning);
+    app.route_dynamic(std::string(url))
+            .websocket()
+            .onaccept([&](const crow::request &req) {
+                std::cout << "New websocket connection from " << req.remoteIpAddress << std::endl;
+                return true;
+            })
+            .onopen([&c, stream](crow::websocket::connection& conn){
+                std::lock_guard<std::mutex> _(c.usr_mtx);
+                ws_client &cl = c.users[&conn];
+                cl.id = c.ws_client_cnt++;
+                cl.last_ack = std::chrono::steady_clock::now();
+                if (stream)
+                    cl.stream = std::make_shared<ws_stream>();
+            })
+            .onmessage([this, &c](crow::websocket::connection& conn, const std::string& data, bool is_binary){
+                if (data == "ack") {
+                    acknowledge(c, conn);
+                } else if (data.rfind("options", 0) == 0) {
+                    std::shared_ptr<ws_stream> s;
+                    {
+                        std::lock_guard<std::mutex> _(c.usr_mtx);
+                        auto it = c.users.find(&conn);
+                        if (it != c.users.end())
+                            s = it->second.stream;
+                    }
+                    if (s) {
+                        // Not under usr_mtx, which send_streams() locks inside s->mtx
+                        std::lock_guard<std::mutex> lk(s->mtx);
+                        s->enc.set_options(data.substr(7));
+                    }
+                }
+            })
+            .onclose([&c](crow::websocket::connection& conn, const std::string& reason){
+                std::cout << "Websocket connection closed." << std::endl;
+                std::lock_guard<std::mutex> _(c.usr_mtx);
+                c.users.erase(&conn);
+            });
+}
+
+void Webserver::add_camera_routes(const std::string &prefix, camera &c)
+{
+    if (!prefix.empty())
+        app.route_dynamic(std::string(prefix))
+            ([prefix]{
+                // Relative URLs in index.html need the trailing slash
+                crow::response res(301);
+                res.set_header("Location", prefix + "/");
+                return res;
+            });
 
-    CROW_ROUTE(app, "/")
+    app.route_dynamic(prefix + "/")
         ([]{ return index_html; });
 
-    CROW_ROUTE(app, "/script.js")
+    app.route_dynamic(prefix + "/script.js")
         ([]{
             crow::response res(script_js);
             res.set_header("Content-Type", "text/javascript");
             return res;
         });
 
-    CROW_ROUTE(app, "/thermocam-current.jpg")
-            ([this](){return send_img(ti.get_preview());});
+    app.route_dynamic(prefix + "/thermocam-current.jpg")
+            ([this, &c](const crow::request &req) {
+                std::shared_ptr<const frame_snapshot> snap = c.snapshot();
+                if (!snap)
+                    return crow::response(404);
+                return send_img(req, c, snap->frame, "thermocam-current", ".jpg",
+                                [&snap]() { return snap->ti.get_preview(); });
+            });
+
+    app.route_dynamic(prefix + "/thermocam-current.tiff")
+            ([this, &c](const crow::request &req) {
+                std::shared_ptr<const frame_snapshot> snap = c.snapshot();
+                if (!snap)
+                    return crow::response(404);
+                return send_img(req, c, snap->frame, "thermocam-current", ".tiff",
+                                [&snap]() { return cv::Mat(snap->ti.get_celsius()); });
+            });
 
-    CROW_ROUTE(app, "/temperatures.txt")
-    ([this](const crow::request& req, crow::response& res){
-        this->lock.lock();
-        std::vector<POI> curr_poi = ti.get_poi();
-        std::vector<std::pair<std::string,double>> curr_cct = this->cameraComponentTemps;
-        this->lock.unlock();
-        sendPOITemp(res, curr_poi);
+    app.route_dynamic(prefix + "/temperatures.txt")
+    ([&c](const crow::request& req, crow::response& res){
+        std::shared_ptr<const frame_snapshot> snap = c.snapshot();
+        c.lock.lock();
+        std::shared_ptr<const camera_temps> curr_cct = c.cameraComponentTemps;
+        c.lock.unlock();
+        if (snap)
+            sendPOITemp(res, snap->ti.get_poi());
         sendCameraComponentTemps(res, curr_cct);
         res.end();
     });
 
-    CROW_ROUTE(app, "/heat-sources.txt")
-    ([this](const crow::request& req, crow::response& res){
-        this->lock.lock();
-        std::vector<HeatSource> curr_heat_sources = ti.get_heat_sources();
-        this->lock.unlock();
-        sendHeatSources(res, curr_heat_sources);
+    app.route_dynamic(prefix + "/heat-sources.txt")
+    ([&c](const crow::request& req, crow::response& res){
+        std::shared_ptr<const frame_snapshot> snap = c.snapshot();
+        if (snap)
+            sendHeatSources(res, snap->ti.get_heat_sources());
         res.end();
     });
 
-    CROW_ROUTE(app, "/points.txt")
-    ([this](const crow::request& req, crow::response& res){
-        this->lock.lock();
-        std::vector<POI> curr_poi = ti.get_poi();
-        std::vector<std::pair<std::string,double>> curr_cct = this->cameraComponentTemps;
-        std::vector<HeatSource> curr_heat_sources = ti.get_heat_sources();
-        this->lock.unlock();
-        sendPOITemp(res, curr_poi);
+    app.route_dynamic(prefix + "/points.txt")
+    ([&c](const crow::request& req, crow::response& res){
+        std::shared_ptr<const frame_snapshot> snap = c.snapshot();
+        c.lock.lock();
+        std::shared_ptr<const camera_temps> curr_cct = c.cameraComponentTemps;
+        c.lock.unlock();
+        if (snap)
+            sendPOITemp(res, snap->ti.get_poi());
         sendCameraComponentTemps(res, curr_cct);
-        sendHeatSources(res, curr_heat_sources);
+        if (snap)
+            sendHeatSources(res, snap->ti.get_heat_sources());
         res.end();
     });
 
-    CROW_ROUTE(app, "/position-std.txt")
-    ([this](const crow::request& req, crow::response& res){
-        this->lock.lock();
-        std::vector<POI> curr_poi = ti.get_poi();
-        this->lock.unlock();
-        sendPOIPosStd(res, curr_poi);
+    app.route_dynamic(prefix + "/position-std.txt")
+    ([&c](const crow::request& req, crow::response& res){
+        std::shared_ptr<const frame_snapshot> snap = c.snapshot();
+        if (snap)
+            sendPOIPosStd(res, snap->ti.get_poi());
         res.end();
     });
 
+    add_websocket_route(prefix + "/ws", c, false);
+    add_websocket_route(prefix + "/stream", c, true);
 
-    CROW_ROUTE(app, "/ws")
-            .websocket()
-            .onaccept([&](const crow::request &req) {
-                std::cout << "New websocket connection from " << req.remoteIpAddress << std::endl;
-                return true;
-            })
-            .onopen([&](crow::websocket::connection& conn){
-                std::lock_guard<std::mutex> _(this->usr_mtx);
-                this->users.insert(&conn);
-            })
-            .onclose([&](crow::websocket::connection& conn, const std::string& reason){
-                std::cout << "Websocket connection closed." << std::endl;
-                std::lock_guard<std::mutex> _(this->usr_mtx);
-                this->users.erase(&conn);
+    app.route_dynamic(prefix + "/frame.txt")
+        ([&c]() {
+            std::shared_ptr<const frame_snapshot> snap = c.snapshot();
+            return to_string(snap ? snap->frame : 0);
+        });
+
+    app.route_dynamic(prefix + "/users.txt")
+        ([&c]() {
+            std::lock_guard<std::mutex> _(c.usr_mtx);
+            return to_string(c.users.size());
+        });
+
+    app.route_dynamic(prefix + "/<path>")
+            ([this, &c, prefix](const crow::request &req, const string &path) {
+                // The images are rendered from the snapshot even if
+                // newer frames arrive in the meantime
+                std::shared_ptr<const frame_snapshot> snap = c.snapshot();
+                const std::string mjpg = ".mjpg";
+                if (path.size() > mjpg.size() && path.compare(path.size() - mjpg.size(), mjpg.size(), mjpg) == 0)
+                    return mjpeg_redirect(req, prefix + "/" + path);
+                if (!snap)
+                    return crow::response(404);
+                for (const auto &webimg_list : snap->ti.get_webimgs()) {
+                    for (const auto &webimg : webimg_list) {
+                        if (path == webimg.name + ".jpg" || path == webimg.name + ".tiff") {
+                            {
+                                std::lock_guard<std::mutex> lk(c.lock);
+                                c.webimg_requests[webimg.name]++;
+                            }
+                            bool jpg = path == webimg.name + ".jpg";
+                            return send_img(req, c, snap->frame, webimg.name, jpg ? ".jpg" : ".tiff",
+                                            [&]() { return jpg ? webimg.rgb() : webimg.mat; });
+                        }
+                    }
+                }
+                return crow::response(404);
             });
+}
+
+void Webserver::start()
+{
+    crow::mustache::set_base(".");
+    app.loglevel(crow::LogLevel::Warning);
 
     CROW_ROUTE(app, "/uptime.txt")
         ([this]() {
@@ -258,30 +996,14 @@ void Webserver::start()
             return to_string(duration_cast<seconds>(now - start_time).count());
         });
 
-    CROW_ROUTE(app, "/frame.txt")
-        ([this]() { return to_string(frame_cnt); });
-
-    CROW_ROUTE(app, "/users.txt")
-        ([this]() { return to_string(users.size()); });
-
     CROW_ROUTE(app, "/metrics")
         ([this]() { return prometheus_metics(); });
 
-    CROW_ROUTE(app, "/<path>")
-            ([this](const string &path) {
-                for (const auto &webimg_list : ti.get_webimgs()) {
-                    for (const auto &webimg : webimg_list) {
-                        if (path == webimg.name + ".jpg") {
-                            return send_img(webimg.rgb);
-                        } else if (path == webimg.name + ".tiff") {
-                            return send_img(webimg.mat, ".tiff");
-                        };
-                    }
-                }
-                return crow::response(404);
-            });
+    for (unsigned i = 0; i < cams.size(); i++)
+        add_camera_routes("/cam" + to_string(i), *cams[i]);
+    add_camera_routes("", *cams[0]);
 
-    app.port(8080)
+    app.port(web_port)
         .multithreaded()
         .run();
 
@@ -4,45 +4,211 @@
 #include <mutex>
 #include <atomic>
 #include "thermo_img.hpp"
+#include "capture.hpp"
+#include "latency.hpp"
+#include "frame_stream.hpp"
+#include "thread_pool.hpp"
 #include <opencv2/core/core.hpp>
 #include <thread>
-#include <unordered_set>
+#include <unordered_map>
+#include <condition_variable>
+#include <map>
 #include <string>
+#include <memory>
+#include <vector>
 #include "crow_all.h"
 #include <chrono>
+#include <functional>
 
 class Webserver
 {
 private:
-    std::mutex lock;
-    thermo_img ti;
+    // Image encoded for HTTP responses
+    struct encoded_img {
+        unsigned long frame;    // frame_cnt of the source image
+        std::string etag;       // Hash of data
+        std::string data;
+    };
 
-    std::vector<std::pair<std::string,double>> cameraComponentTemps;
-    std::unordered_set<crow::websocket::connection*> users;
-    std::mutex usr_mtx;
-    const std::string poi_name;
+    // Cache entry of one image in one format (see send_img())
+    struct encode_slot {
+        std::mutex mtx;         // Held while encoding
+        std::shared_ptr<const encoded_img> img;
+    };
+
+    // Processed frame as published by update(). It is never modified,
+    // so request handlers can use it without locking for as long as
+    // they need.
+    struct frame_snapshot {
+        unsigned long frame;    // Sequence number (from 1)
+        thermo_img ti;
+    };
+
+    // Encoder of a /stream client. mtx is held from encoding a message
+    // until it is sent, so that the client gets delta frames in the
+    // order they were encoded.
+    struct ws_stream {
+        std::mutex mtx;
+        frame_stream_encoder enc;
+        unsigned long frame = 0; // Last sent frame
+    };
+
+    // State of one websocket connection. Clients that acknowledge
+    // update messages (by sending "ack") get at most max_inflight
+    // unacknowledged messages; newer updates wait in pending, which
+    // keeps only the latest one. Clients that do not acknowledge for
+    // timeout while updates are waiting are disconnected. Clients
+    // that have never acknowledged get at most max_unacked messages,
+    // because nothing tells how many of them are still queued, and are
+    // disconnected then. Clients of /stream get binary frames (see
+    // ws_stream) instead of JSON messages.
+    struct ws_client {
+        static constexpr unsigned max_inflight = 2;
+        static constexpr unsigned max_unacked = 64;
+        static constexpr std::chrono::seconds timeout { 10 };
+
+        unsigned id;            // For metrics
+        bool acks = false;      // Whether the client acknowledges messages
+        bool closing = false;
+        unsigned inflight = 0;  // Sent, but not acknowledged messages
+        std::shared_ptr<const frame_snapshot> pending;
+        std::chrono::steady_clock::time_point last_ack;
+        unsigned long dropped = 0; // Messages replaced in pending
+        std::shared_ptr<ws_stream> stream; // Only for /stream clients
+    };
+
+    // /stream message to be encoded after unlocking usr_mtx (see
+    // send_streams())
+    struct stream_send {
+        crow::websocket::connection *conn;
+        std::shared_ptr<ws_stream> stream;
+        std::shared_ptr<const frame_snapshot> snap;
+    };
+
+    // Data of one camera, served under /camN/ (the first camera
+    // also under /)
+    struct camera {
+        // The current frame, replaced atomically by update()
+        std::shared_ptr<const frame_snapshot> snap;
+        std::shared_ptr<const frame_snapshot> snapshot() const { return std::atomic_load(&snap); }
+        unsigned long frame_cnt = 0; // Used only by update()
+
+        std::mutex lock; // Protects the members below (except those with own mutex or atomic)
+        std::shared_ptr<const camera_temps> cameraComponentTemps;
+        capture::stats capture_stats;
+        camera_source::capabilities caps;
+        std::unordered_map<crow::websocket::connection*, ws_client> users;
+        unsigned ws_client_cnt = 0;
+        std::mutex usr_mtx;     // Protects users, ws_client_cnt and the message caches
+
+        // Message of the last sent frame, created for the first
+        // client that needs it
+        unsigned long msg_frame = 0;
+        std::string msg;        // JSON update
+
+        // Part of /stream messages common to all clients, prepared
+        // for the first client of each frame
+        std::mutex stream_mtx;
+        std::shared_ptr<const frame_stream_frame> stream_frame;
+        std::atomic<unsigned long> ws_closed_slow { 0 };
+
+        // Snapshot waiting for broadcast_loop() (protected by bcast_mtx)
+        std::shared_ptr<const frame_snapshot> bcast_snap;
+        std::string poi_name;
+
+        // Number of requests of each webimg (.jpg or .tiff). Images
+        // that are not requested are never rendered.
+        std::map<std::string, unsigned long> webimg_requests;
+
+        // Images of the current frame encoded by send_img(), by
+        // name, format and quality
+        std::mutex enc_mtx;
+        std::map<std::string, std::unique_ptr<encode_slot>> enc_cache;
+        std::atomic<unsigned long> img_encodes { 0 }, img_not_modified { 0 };
+
+        // Latencies of frames passed to update()
+        std::array<latency_histogram, frame_stamps::count> stage_latency; // [grab] is unused
+        latency_histogram frame_latency; // From grab to broadcast
+    };
+    std::vector<std::unique_ptr<camera>> cams;
 
 public:
     std::atomic<bool> finished{ false };
 
-    Webserver(const std::string &poi_path);
+    static constexpr unsigned short web_port = 8080;
+
+    // One POI file (possibly empty) per camera. MJPEG streams of all
+    // cameras are served on mjpeg_port (0 disables them).
+    Webserver(const std::vector<std::string> &poi_paths, unsigned short mjpeg_port = 8081);
     void terminate();
 
-    void update(const thermo_img &ti);
+    void update(const thermo_img &ti, unsigned cam = 0);
 
-    void update_temps(const std::vector<std::pair<std::string, double>> &cct);
+    // Only stores the pointer; the snapshot must not be modified later
+    void update_temps(std::shared_ptr<const camera_temps> cct, unsigned cam = 0);
+
+    void update_capture_stats(const capture::stats &cs, unsigned cam = 0);
+
+    void set_camera(const camera_source::capabilities &caps, unsigned cam = 0);
 
 private:
     std::thread web_thread;
+    std::thread bcast_thread;
+    std::mutex bcast_mtx;
+    std::condition_variable bcast_cv;
+    bool bcast_stop = false;
     crow::SimpleApp app;
     bool img_routes_initialized = false;
     std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-    unsigned long frame_cnt = 0;
+
+    // MJPEG streams (multipart/x-mixed-replace) served on mjpeg_port by
+    // mjpeg_thread, because crow cannot stream responses. Images are
+    // encoded in mjpeg_pool, so that slow encoding does not stall the
+    // I/O of other streams.
+    const unsigned short mjpeg_port;
+    struct mjpeg_client;
+    boost::asio::io_service mjpeg_io;
+    std::unique_ptr<boost::asio::ip::tcp::acceptor> mjpeg_acceptor;
+    std::vector<std::shared_ptr<mjpeg_client>> mjpeg_clients; // Used only by mjpeg_thread
+    std::atomic<unsigned> mjpeg_streams { 0 };
+    std::thread mjpeg_thread;
+    std::unique_ptr<thread_pool> mjpeg_pool; // Destroyed before mjpeg_io
 
     void start();
-    void noticeClients();
+    void add_camera_routes(const std::string &prefix, camera &c);
+    void broadcast_loop();
+    void broadcast(camera &c, const std::shared_ptr<const frame_snapshot> &snap);
+    void acknowledge(camera &c, crow::websocket::connection &conn);
+    void send_update(camera &c, crow::websocket::connection &conn, ws_client &cl,
+                     const std::shared_ptr<const frame_snapshot> &snap, std::vector<stream_send> &streams);
+    void send_streams(camera &c, const std::vector<stream_send> &streams);
+    std::shared_ptr<const frame_stream_frame> stream_frame(camera &c, const frame_snapshot &snap);
+    void add_websocket_route(const std::string &url, camera &c, bool stream);
+    static std::string update_message(const frame_snapshot &snap);
+    size_t users_count();
+    void mjpeg_start();
+    void mjpeg_accept();
+    void mjpeg_request(std::shared_ptr<mjpeg_client> cl);
+    void mjpeg_frame();
+    void mjpeg_send(std::shared_ptr<mjpeg_client> cl);
+    crow::response mjpeg_redirect(const crow::request &req, const std::string &path);
+    void mjpeg_write(std::shared_ptr<mjpeg_client> cl, std::shared_ptr<const encoded_img> img);
+
+    // Image encoded to the format given by ext (".jpg" or ".tiff"),
+    // cached per frame. get_img returns the image of the given frame;
+    // it is called only if that frame is not in the cache. The result
+    // is always the image of the given frame. Returns nullptr if the
+    // image cannot be encoded.
+    std::shared_ptr<const encoded_img> encode(camera &c, unsigned long frame, const std::string &name,
+                                              const std::string &ext, int quality,
+                                              const std::function<cv::Mat()> &get_img);
 
-    crow::response send_img(const cv::Mat &img, const std::string &ext = ".jpg");
+    // Send image from encode(). JPEG quality is given by the quality
+    // URL parameter. Responds 304 Not Modified if the client has the
+    // same image (If-None-Match).
+    crow::response send_img(const crow::request &req, camera &c, unsigned long frame,
+                            const std::string &name, const std::string &ext,
+                            const std::function<cv::Mat()> &get_img);
     std::string prometheus_metics();
 };
 
@@ -0,0 +1,184 @@
+#ifdef WITH_WIC_SDK
+
+#include "wic_source.hpp"
+#include "frame_pool.hpp"
+#include <err.h>
+#include <cstring>
+#include <iostream>
+
+using namespace cv;
+using namespace std;
+
+#define CAM_FPS 9 // The camera is 9Hz
+
+wic_source::wic_source(const string &license_file)
+    : license(license_file)
+    , wic(init_wic())
+    , grabber(init_grabber())
+{
+    auto resolution = wic->getResolution();
+    width = resolution.first;
+    height = resolution.second;
+    update_lut();
+}
+
+wic_source::~wic_source()
+{
+    grabber = nullptr;
+    delete wic;
+}
+
+camera_source::capabilities wic_source::get_capabilities() const
+{
+    capabilities c;
+    c.backend = "wic";
+    c.width = width;
+    c.height = height;
+    c.fps = CAM_FPS;
+    c.formats = { pixel_format::raw16 };
+    c.live = true;
+    return c;
+}
+
+bool wic_source::get_image(Mat_<uint16_t> &result, chrono::system_clock::time_point &time)
+{
+    {
+        lock_guard<mutex> lk(sdk_mtx);
+        if (!grabber->isConnected()) {
+            err(1,"Lost connection to camera, exiting.");
+        }
+        update_lut();
+    }
+
+    // The sensor temperature is polled in background by
+    // img_stream, because reading it takes long.
+    auto temps = get_component_temps();
+    double sensor_temp = temps ? temps->get("camera_sensor") : 0;
+
+    // The buffer is allocated by the SDK. We copy it to a pooled
+    // frame buffer and calibrate it there. Waiting for the frame
+    // is done without sdk_mtx, so that the grabbing does not wait
+    // for temperature reads.
+    vector<uint8_t> buffer = grabber->getBuffer(1000);
+    time = chrono::system_clock::now();
+
+    if (buffer.size() == 0) {
+        if (empty_buffer_cnt++ > 10) {
+            // Exit and let systemd restart us
+            errx(1, "Empty buffer detected!!!!!!!!!!!!!!!!!!!!!!!!!!");
+        }
+    } else {
+        empty_buffer_cnt = 0;
+    }
+
+    frame_pool::instance().create(result, height, width);
+    size_t size = std::min(result.total()*result.elemSize(), buffer.size());
+    memcpy(result.data, buffer.data(), size);
+    lock_guard<mutex> lg(sdk_mtx);
+    wic->calibrateRawInplace(reinterpret_cast<uint16_t*>(result.data), size / 2,
+                             std::isnan(sensor_temp) ? 0 : sensor_temp);
+    return true;
+}
+
+uint16_t wic_source::celsius_to_raw(double celsius) const
+{
+    return wic::celsiusToRaw(celsius, lut_resolution);
+}
+
+// Each temperature is read under its own lock, so that the capture
+// thread waits for at most one read.
+double wic_source::read_temp(wic::CameraTemperature which)
+{
+    lock_guard<mutex> lk(sdk_mtx);
+    return wic->getCameraTemperature(which).second.value_or(0.0);
+}
+
+vector<pair<string, double>> wic_source::read_component_temps()
+{
+    return { { "camera_shutter", read_temp(wic::CameraTemperature::ShutterTemp) },
+             { "camera_sensor",  read_temp(wic::CameraTemperature::SensorTemp) },
+             { "camera_housing", read_temp(wic::CameraTemperature::HousingTemp) } };
+}
+
+double wic_source::read_sensor_temp()
+{
+    return read_temp(wic::CameraTemperature::SensorTemp);
+}
+
+// Called for every frame, so that the table follows temperature
+// resolution changes. Called with sdk_mtx locked (except from the
+// constructor).
+void wic_source::update_lut()
+{
+    auto tempRes = wic->getCurrentTemperatureResolution();
+    if (get_lut() && tempRes == lut_resolution)
+        return;
+    lut_resolution = tempRes;
+    set_lut([&](uint16_t raw) {
+        return wic::rawToCelsius(raw, tempRes);
+    });
+}
+
+wic::WIC *wic_source::init_wic()
+{
+    if (!license.isOk())
+        errx(1, "wic license invalid");
+
+    auto wic = wic::findAndConnect(license);
+
+    if (!wic)
+        errx(1, "wic::findAndConnect: Camera not found");
+
+    auto defaultRes = wic->doDefaultWICSettings();
+    if (defaultRes.first != wic::ResponseStatus::Ok) {
+        std::cerr << "DoDefaultWICSettings error: "
+                  << wic::responseStatusToStr(defaultRes.first) << std::endl;
+        exit(1);
+    }
+
+    auto resolution = wic->getResolution();
+    if (resolution.first == 0 || resolution.second == 0) {
+        std::cerr << "Invalid resolution, core detection error." << std::endl;
+        exit(1);
+    }
+
+    auto rangeAndLens = wic->getRangeAndLens();
+
+    // if no lens were detected, set desired lens from license file
+    // this may take a few minutes, especially with validateMemory flag on
+    if (rangeAndLens.second.empty() &&
+        !license.calibrationData().lensCalibrationData().empty()) {
+        auto lens =
+            license.calibrationData().lensCalibrationData().begin()->lens();
+        cerr << "wic::setRangeAndLensRes..." << endl;
+        auto setRangeAndLensRes =
+            wic->setRangeAndLens(wic::Range::Low, lens, false, false);
+
+        if (setRangeAndLensRes.second) {
+            std::cerr << "Errors occurred while uploading calibration. " << wic::responseStatusToStr(setRangeAndLensRes.first)
+                      << std::endl
+                      << "lens: " << lens << "; error count: "
+                      << setRangeAndLensRes.second.value_or(0) << " out of "
+                      << 2 * resolution.first * resolution.second / 128 << endl;
+            exit(1);
+        }
+        cerr << "done" << endl;
+    }
+    return wic;
+}
+
+wic::FrameGrabber *wic_source::init_grabber()
+{
+    if (!wic)
+        err(1,"No camera found");
+
+    wic::FrameGrabber *grabber = wic->frameGrabber();
+    if (!grabber)
+        errx(1,"Error connecting camera");
+
+    grabber->setup();
+
+    return grabber;
+}
+
+#endif // WITH_WIC_SDK
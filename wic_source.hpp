@@ -0,0 +1,46 @@
+#ifndef WIC_SOURCE_HPP
+#define WIC_SOURCE_HPP
+
+#ifdef WITH_WIC_SDK
+
+#include "camera_source.hpp"
+#include <wic/calibrationdata.h>
+#include <wic/camerafinder.h>
+#include <wic/framegrabber.h>
+#include <wic/wic.h>
+#include <mutex>
+
+// WorksWell thermal camera accessed via WIC SDK
+class wic_source : public camera_source {
+public:
+    explicit wic_source(const std::string &license_file);
+    ~wic_source();
+
+    capabilities get_capabilities() const override;
+    bool get_image(cv::Mat_<uint16_t> &result, std::chrono::system_clock::time_point &time) override;
+    uint16_t celsius_to_raw(double celsius) const override;
+    std::vector<std::pair<std::string, double>> read_component_temps() override;
+    double read_sensor_temp() override;
+
+private:
+    wic::LicenseFile license;
+    wic::WIC *wic = nullptr;
+    wic::FrameGrabber *grabber = nullptr;
+    // The SDK is not documented to be thread-safe. Component
+    // temperatures are read by the img_stream telemetry thread, while
+    // the capture thread grabs frames. Waiting for a frame in the
+    // grabber is not protected, only the calls of the wic object.
+    std::mutex sdk_mtx;
+    int width, height;
+    decltype(std::declval<wic::WIC>().getCurrentTemperatureResolution()) lut_resolution;
+    unsigned empty_buffer_cnt = 0;
+
+    wic::WIC *init_wic();
+    wic::FrameGrabber *init_grabber();
+    void update_lut();
+    double read_temp(wic::CameraTemperature which);
+};
+
+#endif // WITH_WIC_SDK
+
+#endif // WIC_SOURCE_HPP